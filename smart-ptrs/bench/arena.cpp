@@ -0,0 +1,63 @@
+#include "bench.h"
+
+#include <unique/arena.h>
+#include <unique/unique.h>
+
+#include <type_traits>
+
+// Per-request parse trees: build a binary tree, walk it, drop it. Nodes from `new` with
+// `UniquePtr<Node>`, against nodes from a `MonotonicArena` that lives for one request and frees
+// its chunks at once.
+
+constexpr size_t kNumNodes = 10'000'000;
+constexpr int kDepth = 12;
+
+template <typename Ptr>
+struct Node {
+    int value;
+    Ptr left;
+    Ptr right;
+};
+
+struct HeapNode : Node<UniquePtr<HeapNode>> {};
+struct ArenaNode : Node<UniquePtr<ArenaNode, ArenaDeleter<ArenaNode>>> {};
+
+template <typename Make>
+std::invoke_result_t<Make&> Build(int depth, Make& make) {
+    auto node = make();
+    node->value = depth;
+    if (depth > 0) {
+        node->left = Build(depth - 1, make);
+        node->right = Build(depth - 1, make);
+    }
+    return node;
+}
+
+template <typename NodePtr>
+long Sum(const NodePtr& node) {
+    return node ? node->value + Sum(node->left) + Sum(node->right) : 0;
+}
+
+template <typename Request>
+void Run(const char* name, Request&& request) {
+    size_t nodes_per_tree = (size_t{1} << (kDepth + 1)) - 1;
+    size_t num_trees = kNumNodes / nodes_per_tree;
+    double ns = RunThreads(1, [&](size_t) {
+        for (size_t i = 0; i < num_trees; ++i) {
+            DoNotOptimize(request());
+        }
+    });
+    Report(name, 1, ns, num_trees * nodes_per_tree);
+}
+
+int main() {
+    Run("UniquePtr with new, per node", [] {
+        auto make = [] { return UniquePtr<HeapNode>(new HeapNode()); };
+        return Sum(Build(kDepth, make));
+    });
+    Run("MonotonicArena per request, per node", [] {
+        MonotonicArena arena;
+        auto make = [&arena] { return MakeUniqueIn<ArenaNode>(arena); };
+        return Sum(Build(kDepth, make));
+    });
+}
@@ -0,0 +1,76 @@
+#include "bench.h"
+
+#include <weak/atomic_shared.h>
+
+#include <mutex>
+
+// A shared config: reader threads load it and read a field, one extra thread replaces it every
+// `kWriteEvery` loads of reader 0. `AtomicSharedPtr` against `SharedPtr` behind a mutex.
+
+struct Config {
+    int version;
+    char payload[56];
+};
+
+using Ptr = SharedPtr<Config, AtomicCounter>;
+
+constexpr size_t kNumIters = 2'000'000;
+constexpr size_t kWriteEvery = 1000;
+
+class MutexSharedPtr {
+public:
+    explicit MutexSharedPtr(Ptr ptr) : ptr_(std::move(ptr)) {
+    }
+
+    Ptr Load() const {
+        std::lock_guard lock(mutex_);
+        return ptr_;
+    }
+
+    void Store(Ptr ptr) {
+        std::lock_guard lock(mutex_);
+        ptr_.Swap(ptr);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    Ptr ptr_;
+};
+
+template <typename Shared>
+void ReadMostly(const char* name, size_t num_readers) {
+    Shared shared(MakeShared<Config, AtomicCounter>(Config{0, {}}));
+    std::atomic<size_t> reads = 0;
+    std::atomic<bool> done = false;
+    double ns = RunThreads(num_readers + 1, [&](size_t index) {
+        if (index == num_readers) {
+            for (int version = 1; !done.load(std::memory_order_relaxed); ++version) {
+                shared.Store(MakeShared<Config, AtomicCounter>(Config{version, {}}));
+                size_t target = reads.load(std::memory_order_relaxed) + kWriteEvery;
+                while (reads.load(std::memory_order_relaxed) < target &&
+                       !done.load(std::memory_order_relaxed)) {
+                    std::this_thread::yield();
+                }
+            }
+            return;
+        }
+        for (size_t i = 0; i < kNumIters; ++i) {
+            Ptr config = shared.Load();
+            DoNotOptimize(config->version);
+            if (index == 0) {
+                reads.store(i, std::memory_order_relaxed);
+            }
+        }
+        if (index == 0) {
+            done.store(true);
+        }
+    });
+    Report(name, num_readers, ns, kNumIters);
+}
+
+int main() {
+    for (size_t readers = 1; readers <= MaxThreads(); readers *= 2) {
+        ReadMostly<AtomicSharedPtr<Config>>("read-mostly/AtomicSharedPtr", readers);
+        ReadMostly<MutexSharedPtr>("read-mostly/mutex + SharedPtr", readers);
+    }
+}
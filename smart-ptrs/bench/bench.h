@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Keeps `value` alive so the compiler cannot drop the measured code.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs `body(thread_index)` on `num_threads` threads at once and returns the wall time in ns.
+template <typename Body>
+double RunThreads(size_t num_threads, Body&& body) {
+    std::atomic<size_t> ready = 0;
+    std::atomic<bool> start = false;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&, i] {
+            ++ready;
+            while (!start.load(std::memory_order_acquire)) {
+            }
+            body(i);
+        });
+    }
+    while (ready.load() != num_threads) {
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+inline void Report(const char* name, size_t num_threads, double total_ns, size_t num_ops) {
+    std::printf("%-48s threads=%-3zu %8.2f ns/op\n", name, num_threads, total_ns / num_ops);
+}
+
+inline size_t MaxThreads() {
+    size_t hardware = std::thread::hardware_concurrency();
+    return hardware == 0 ? 1 : hardware;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Suites with statistics
+
+// Command line of a suite:
+//     --warmup=N          untimed runs before the measured ones (default 1)
+//     --repetitions=N     measured runs (default 15)
+//     --max-threads=N     thread counts 1, 2, 4, ... and N (default: hardware threads)
+//     --filter=TEXT       only cases whose name contains TEXT
+//     --json=PATH         also write the results to PATH as JSON
+struct BenchOptions {
+    size_t warmup = 1;
+    size_t repetitions = 15;
+    size_t max_threads = MaxThreads();
+    std::string filter;
+    std::string json;
+
+    static BenchOptions Parse(int argc, char** argv) {
+        BenchOptions options;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&arg](const char* flag) -> const char* {
+                size_t length = std::char_traits<char>::length(flag);
+                return arg.compare(0, length, flag) == 0 ? arg.c_str() + length : nullptr;
+            };
+            if (const char* v = value("--warmup=")) {
+                options.warmup = std::strtoull(v, nullptr, 10);
+            } else if (const char* v = value("--repetitions=")) {
+                options.repetitions = std::max<size_t>(1, std::strtoull(v, nullptr, 10));
+            } else if (const char* v = value("--max-threads=")) {
+                options.max_threads = std::max<size_t>(1, std::strtoull(v, nullptr, 10));
+            } else if (const char* v = value("--filter=")) {
+                options.filter = v;
+            } else if (const char* v = value("--json=")) {
+                options.json = v;
+            } else {
+                std::fprintf(stderr, "unknown option %s\n", argv[i]);
+                std::exit(2);
+            }
+        }
+        return options;
+    }
+};
+
+// ns/op over the measured runs of one case.
+struct BenchResult {
+    std::string name;
+    size_t threads;
+    size_t ops;  // Per run, all threads together
+    double median_ns;
+    double p99_ns;  // Nearest rank: the slowest run unless there are more than 100
+    double min_ns;
+};
+
+// Runs cases, prints one line per case and writes JSON at the end if asked to.
+//
+//     BenchSuite suite(argc, argv);
+//     for (size_t threads : suite.Threads()) {
+//         suite.Run("copy", threads, kOps, [&](size_t thread_index, size_t ops) { ... });
+//     }
+class BenchSuite {
+public:
+    BenchSuite(int argc, char** argv) {
+        options_ = BenchOptions::Parse(argc, argv);
+    }
+
+    BenchSuite(const BenchSuite&) = delete;
+    BenchSuite& operator=(const BenchSuite&) = delete;
+
+    ~BenchSuite() {
+        if (!options_.json.empty()) {
+            WriteJson();
+        }
+    }
+
+    const BenchOptions& Options() const {
+        return options_;
+    }
+
+    std::vector<size_t> Threads() const {
+        std::vector<size_t> threads;
+        for (size_t count = 1; count < options_.max_threads; count *= 2) {
+            threads.push_back(count);
+        }
+        threads.push_back(options_.max_threads);
+        return threads;
+    }
+
+    bool Selected(const std::string& name) const {
+        return name.find(options_.filter) != std::string::npos;
+    }
+
+    // `body(thread_index, ops)` performs `ops` operations; every thread gets the same number.
+    template <typename Body>
+    void Run(const std::string& name, size_t num_threads, size_t ops_per_thread, Body&& body) {
+        if (!Selected(name)) {
+            return;
+        }
+        size_t ops = ops_per_thread * num_threads;
+        std::vector<double> samples;
+        for (size_t run = 0; run < options_.warmup + options_.repetitions; ++run) {
+            double ns = RunThreads(num_threads, [&](size_t index) { body(index, ops_per_thread); });
+            if (run >= options_.warmup) {
+                samples.push_back(ns / ops);
+            }
+        }
+        std::sort(samples.begin(), samples.end());
+        auto rank = static_cast<size_t>(std::ceil(0.99 * samples.size())) - 1;
+        BenchResult result{name, num_threads, ops, samples[samples.size() / 2], samples[rank],
+                           samples.front()};
+        std::printf("%-48s threads=%-3zu %8.2f ns/op  p99 %8.2f  min %8.2f\n", name.c_str(),
+                    num_threads, result.median_ns, result.p99_ns, result.min_ns);
+        std::fflush(stdout);
+        results_.push_back(std::move(result));
+    }
+
+private:
+    BenchOptions options_;
+    std::vector<BenchResult> results_;
+
+    void WriteJson() const {
+        std::FILE* file = std::fopen(options_.json.c_str(), "w");
+        if (file == nullptr) {
+            std::fprintf(stderr, "cannot write %s\n", options_.json.c_str());
+            return;
+        }
+        std::fprintf(file, "{\n  \"warmup\": %zu,\n  \"repetitions\": %zu,\n  \"results\": [",
+                     options_.warmup, options_.repetitions);
+        for (size_t i = 0; i < results_.size(); ++i) {
+            const BenchResult& r = results_[i];
+            // Case names are plain ASCII without quotes or backslashes.
+            std::fprintf(file,
+                         "%s\n    {\"name\": \"%s\", \"threads\": %zu, \"ops\": %zu, "
+                         "\"median_ns\": %.3f, \"p99_ns\": %.3f, \"min_ns\": %.3f}",
+                         i == 0 ? "" : ",", r.name.c_str(), r.threads, r.ops, r.median_ns,
+                         r.p99_ns, r.min_ns);
+        }
+        std::fprintf(file, "\n  ]\n}\n");
+        std::fclose(file);
+    }
+};
@@ -0,0 +1,46 @@
+#include "bench.h"
+
+#include <weak/biased_counter.h>
+#include <weak/shared.h>
+
+// Copy/destroy cost of `BiasedCounter` against the other policies.
+//
+// "owner": each thread copies a pointer it created itself (the case biasing is made for).
+// "foreign": all threads copy one pointer created by the main thread, so everybody pays the
+// atomic path.
+
+constexpr size_t kNumIters = 10'000'000;
+
+template <typename Counter>
+void CopyDestroyOwner(const char* name, size_t num_threads) {
+    double ns = RunThreads(num_threads, [](size_t) {
+        auto sp = MakeShared<int, Counter>(42);
+        for (size_t i = 0; i < kNumIters; ++i) {
+            SharedPtr<int, Counter> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+    Report(name, num_threads, ns, kNumIters);
+}
+
+template <typename Counter>
+void CopyDestroyForeign(const char* name, size_t num_threads) {
+    auto sp = MakeShared<int, Counter>(42);
+    double ns = RunThreads(num_threads, [&sp](size_t) {
+        for (size_t i = 0; i < kNumIters; ++i) {
+            SharedPtr<int, Counter> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+    Report(name, num_threads, ns, kNumIters);
+}
+
+int main() {
+    for (size_t num_threads = 1; num_threads <= MaxThreads(); num_threads *= 2) {
+        CopyDestroyOwner<SingleThreadedCounter>("owner/SingleThreadedCounter", num_threads);
+        CopyDestroyOwner<AtomicCounter>("owner/AtomicCounter", num_threads);
+        CopyDestroyOwner<BiasedCounter>("owner/BiasedCounter", num_threads);
+        CopyDestroyForeign<AtomicCounter>("foreign/AtomicCounter", num_threads);
+        CopyDestroyForeign<BiasedCounter>("foreign/BiasedCounter", num_threads);
+    }
+}
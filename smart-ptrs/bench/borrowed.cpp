@@ -0,0 +1,48 @@
+#include "bench.h"
+
+#include <weak/borrowed.h>
+#include <weak/shared.h>
+
+// Passing a pointer down a 10-deep call chain: by value (an atomic increment and decrement per
+// frame), by `const SharedPtr&` and as `Borrowed`. Build with `-DNDEBUG`: debug builds register
+// every borrow.
+
+using Ptr = SharedPtr<int, AtomicCounter>;
+
+constexpr size_t kNumIters = 10'000'000;
+constexpr int kDepth = 10;
+
+__attribute__((noinline)) int ByValue(Ptr ptr, int depth) {
+    return depth == 0 ? *ptr : ByValue(ptr, depth - 1) + 1;
+}
+
+__attribute__((noinline)) int ByReference(const Ptr& ptr, int depth) {
+    return depth == 0 ? *ptr : ByReference(ptr, depth - 1) + 1;
+}
+
+__attribute__((noinline)) int ByBorrow(Borrowed<int, AtomicCounter> ptr, int depth) {
+    return depth == 0 ? *ptr : ByBorrow(ptr, depth - 1) + 1;
+}
+
+template <typename Call>
+void Chain(const char* name, size_t num_threads, Call call) {
+    size_t iters = kNumIters / num_threads;
+    auto ptr = MakeShared<int, AtomicCounter>(1);
+    double ns = RunThreads(num_threads, [&](size_t) {
+        for (size_t i = 0; i < iters; ++i) {
+            int result = call(ptr);
+            DoNotOptimize(result);
+        }
+    });
+    Report(name, num_threads, ns, iters * num_threads);
+}
+
+int main() {
+    for (size_t threads = 1; threads <= MaxThreads(); threads *= 2) {
+        Chain("10-deep chain, by value", threads, [](const Ptr& p) { return ByValue(p, kDepth); });
+        Chain("10-deep chain, const SharedPtr&", threads,
+              [](const Ptr& p) { return ByReference(p, kDepth); });
+        Chain("10-deep chain, Borrowed", threads,
+              [](const Ptr& p) { return ByBorrow(p, kDepth); });
+    }
+}
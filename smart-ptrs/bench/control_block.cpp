@@ -0,0 +1,97 @@
+#include "bench.h"
+
+#include <weak/shared.h>
+
+// Size and last-release latency of the function-pointer control blocks against the previous
+// virtual ones (reproduced below with the same counter word).
+
+template <typename Counter>
+class VirtualControlBlock : private Counter {
+public:
+    virtual ~VirtualControlBlock() = default;
+
+    void DecreaseSharedCounter() {
+        if (Counter::DecreaseShared()) {
+            Destroy();
+            if (Counter::DecreaseWeak()) {
+                delete this;
+            }
+        }
+    }
+
+private:
+    virtual void Destroy() = 0;
+};
+
+template <typename T, typename Counter>
+class VirtualControlBlockPtr : public VirtualControlBlock<Counter> {
+public:
+    VirtualControlBlockPtr(T* ptr) : ptr_(ptr) {
+    }
+
+private:
+    T* ptr_;
+
+    void Destroy() override {
+        delete ptr_;
+    }
+};
+
+template <typename T, typename Counter>
+class VirtualControlBlockObject : public VirtualControlBlock<Counter> {
+public:
+    VirtualControlBlockObject() {
+        ::new (&storage_) T();
+    }
+
+private:
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
+
+    void Destroy() override {
+        std::destroy_at(std::launder(reinterpret_cast<T*>(&storage_)));
+    }
+};
+
+constexpr size_t kNumIters = 10'000'000;
+
+// Blocks are created up front, so only the release itself is timed.
+template <typename Block, typename Make>
+void Release(const char* name, Make make) {
+    constexpr size_t kBatch = 100'000;
+    std::vector<Block*> blocks(kBatch);
+    double total_ns = 0;
+    for (size_t done = 0; done < kNumIters; done += kBatch) {
+        for (auto& block : blocks) {
+            block = make();
+        }
+        total_ns += RunThreads(1, [&blocks](size_t) {
+            for (auto* block : blocks) {
+                block->DecreaseSharedCounter();
+            }
+        });
+    }
+    Report(name, 1, total_ns, kNumIters);
+}
+
+template <typename Counter>
+void Compare(const char* counter) {
+    std::printf("%s: sizeof ControlBlockPtr<int> %zu -> %zu, ControlBlockObject<int> %zu -> %zu\n",
+                counter, sizeof(VirtualControlBlockPtr<int, Counter>),
+                sizeof(ControlBlockPtr<int, Counter>),
+                sizeof(VirtualControlBlockObject<int, Counter>),
+                sizeof(ControlBlockObject<int, Counter>));
+
+    Release<VirtualControlBlock<Counter>>(
+        "release ptr/virtual", [] { return new VirtualControlBlockPtr<int, Counter>(new int); });
+    Release<ControlBlock<Counter>>("release ptr/manager",
+                                   [] { return new ControlBlockPtr<int, Counter>(new int); });
+    Release<VirtualControlBlock<Counter>>(
+        "release object/virtual", [] { return new VirtualControlBlockObject<int, Counter>(); });
+    Release<ControlBlock<Counter>>("release object/manager",
+                                   [] { return new ControlBlockObject<int, Counter>(); });
+}
+
+int main() {
+    Compare<SingleThreadedCounter>("SingleThreadedCounter");
+    Compare<AtomicCounter>("AtomicCounter");
+}
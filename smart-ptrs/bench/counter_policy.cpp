@@ -0,0 +1,43 @@
+#include "bench.h"
+
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+// Copy/destroy throughput of `SingleThreadedCounter` vs `AtomicCounter`.
+//
+// "private": every thread copies its own pointer, so only the cost of the RMW itself is measured
+// (this is the case where single-threaded counters are still allowed).
+// "shared": all threads copy the same pointer and fight for its cache line (atomic only).
+
+constexpr size_t kNumIters = 10'000'000;
+
+template <typename Counter>
+void CopyDestroyPrivate(const char* name, size_t num_threads) {
+    double ns = RunThreads(num_threads, [](size_t) {
+        auto sp = MakeShared<int, Counter>(42);
+        for (size_t i = 0; i < kNumIters; ++i) {
+            SharedPtr<int, Counter> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+    Report(name, num_threads, ns, kNumIters);
+}
+
+void CopyDestroyShared(size_t num_threads) {
+    auto sp = MakeShared<int, AtomicCounter>(42);
+    double ns = RunThreads(num_threads, [&sp](size_t) {
+        for (size_t i = 0; i < kNumIters; ++i) {
+            SharedPtr<int, AtomicCounter> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+    Report("shared/AtomicCounter", num_threads, ns, kNumIters);
+}
+
+int main() {
+    for (size_t num_threads = 1; num_threads <= MaxThreads(); num_threads *= 2) {
+        CopyDestroyPrivate<SingleThreadedCounter>("private/SingleThreadedCounter", num_threads);
+        CopyDestroyPrivate<AtomicCounter>("private/AtomicCounter", num_threads);
+        CopyDestroyShared(num_threads);
+    }
+}
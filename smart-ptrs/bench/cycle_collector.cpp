@@ -0,0 +1,94 @@
+#include "bench.h"
+
+#include <weak/cycle_collector.h>
+#include <weak/shared.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// Pause times of `CycleCollector::Collect` on graphs of `kNodes` objects: one large cycle, many
+// small ones, a random graph with two edges per node, and the same graph while it is still
+// referenced from outside (traced twice and kept).
+
+constexpr size_t kNodes = 1'000'000;
+constexpr size_t kRounds = 5;
+
+struct Node {
+    using Ptr = SharedPtr<Node, CycleCollectedCounter>;
+
+    std::vector<Ptr> edges;
+    int64_t payload = 0;
+
+    void Trace(CycleTracer& tracer) const {
+        for (const Ptr& edge : edges) {
+            tracer(edge);
+        }
+    }
+};
+
+using Ptr = Node::Ptr;
+
+std::vector<Ptr> MakeNodes() {
+    std::vector<Ptr> nodes;
+    nodes.reserve(kNodes);
+    for (size_t i = 0; i < kNodes; ++i) {
+        nodes.push_back(MakeShared<Node, CycleCollectedCounter>());
+    }
+    return nodes;
+}
+
+Ptr Ring(std::vector<Ptr> nodes) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i]->edges.push_back(nodes[(i + 1) % nodes.size()]);
+    }
+    return nodes[0];
+}
+
+Ptr Pairs(std::vector<Ptr> nodes) {
+    for (size_t i = 0; i + 1 < nodes.size(); i += 2) {
+        nodes[i]->edges.push_back(nodes[i + 1]);
+        nodes[i + 1]->edges.push_back(nodes[i]);
+    }
+    return nullptr;
+}
+
+Ptr Random(std::vector<Ptr> nodes) {
+    std::mt19937 random(42);
+    std::uniform_int_distribution<size_t> index(0, nodes.size() - 1);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i]->edges.push_back(nodes[(i + 1) % nodes.size()]);
+        nodes[i]->edges.push_back(nodes[index(random)]);
+    }
+    return nodes[0];
+}
+
+// `build` takes the nodes, links them and returns a pointer kept during the collection, if any.
+template <typename Build>
+void Pause(const char* name, Build build, bool keep) {
+    std::vector<double> samples;
+    size_t freed = 0;
+    for (size_t round = 0; round < kRounds; ++round) {
+        Ptr kept = build(MakeNodes());
+        if (!keep) {
+            kept.Reset();
+        }
+        auto begin = std::chrono::steady_clock::now();
+        freed = CycleCollector::Collect();
+        auto end = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+        kept.Reset();
+        CycleCollector::Collect();
+    }
+    std::sort(samples.begin(), samples.end());
+    std::printf("%-16s freed %8zu  min %7.1f ms  median %7.1f ms  max %7.1f ms  %6.1f ns/node\n",
+                name, freed, samples.front(), samples[kRounds / 2], samples.back(),
+                samples[kRounds / 2] * 1e6 / kNodes);
+}
+
+int main() {
+    Pause("ring/garbage", Ring, false);
+    Pause("pairs/garbage", Pairs, false);
+    Pause("random/garbage", Random, false);
+    Pause("random/live", Random, true);
+}
@@ -0,0 +1,48 @@
+#include "bench.h"
+
+#include <weak/deferred_counter.h>
+#include <weak/shared.h>
+
+#include <algorithm>
+#include <vector>
+
+// Time spent in the last release of a graph of `kChildren` objects on the releasing thread:
+// inline destruction (`AtomicCounter`) against `DeferredCounter`.
+
+constexpr size_t kChildren = 10'000;
+constexpr size_t kRounds = 200;
+
+template <typename Counter>
+struct Graph {
+    std::vector<SharedPtr<std::vector<int>, Counter>> children;
+};
+
+template <typename Counter>
+void LastRelease(const char* name) {
+    std::vector<double> samples;
+    for (size_t round = 0; round < kRounds; ++round) {
+        auto graph = MakeShared<Graph<Counter>, Counter>();
+        for (size_t i = 0; i < kChildren; ++i) {
+            graph->children.push_back(MakeShared<std::vector<int>, Counter>(16, 1));
+        }
+        auto begin = std::chrono::steady_clock::now();
+        graph.Reset();
+        auto end = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration<double, std::nano>(end - begin).count());
+        if constexpr (std::is_same_v<Counter, DeferredCounter>) {
+            DeferredReclaimer::Flush();
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+    std::printf("%-32s p50 %10.0f ns   p99 %10.0f ns\n", name, samples[kRounds / 2],
+                samples[kRounds * 99 / 100]);
+}
+
+int main() {
+    LastRelease<AtomicCounter>("last release/AtomicCounter");
+    LastRelease<DeferredCounter>("last release/DeferredCounter");
+    auto stats = DeferredReclaimer::GetStats();
+    std::printf("reclaimed %zu, mean latency %.0f ns, max latency %llu ns\n", stats.reclaimed,
+                static_cast<double>(stats.total_latency_ns) / stats.reclaimed,
+                static_cast<unsigned long long>(stats.max_latency_ns));
+}
@@ -0,0 +1,46 @@
+#include "bench.h"
+
+#include <intrusive/intrusive.h>
+#include <unique/unique.h>
+#include <weak/shared.h>
+
+#include <chrono>
+
+// Destruction of a 10M-node linked list through its head. Without `DestructionWorklist` every
+// node adds stack frames and the process runs out of stack long before the end of the chain.
+
+constexpr size_t kNodes = 10'000'000;
+
+struct SharedNode {
+    SharedPtr<SharedNode> next;
+};
+
+struct UniqueNode {
+    UniquePtr<UniqueNode> next;
+};
+
+struct IntrusiveNode : SimpleRefCounted<IntrusiveNode> {
+    IntrusivePtr<IntrusiveNode> next;
+};
+
+template <typename Ptr, typename Make>
+void DestroyChain(const char* name, Make make) {
+    Ptr head;
+    for (size_t i = 0; i < kNodes; ++i) {
+        Ptr node = make();
+        node->next = std::move(head);
+        head = std::move(node);
+    }
+    auto begin = std::chrono::steady_clock::now();
+    head.Reset();
+    auto end = std::chrono::steady_clock::now();
+    Report(name, 1, std::chrono::duration<double, std::nano>(end - begin).count(), kNodes);
+}
+
+int main() {
+    DestroyChain<SharedPtr<SharedNode>>("chain/SharedPtr", [] { return MakeShared<SharedNode>(); });
+    DestroyChain<UniquePtr<UniqueNode>>("chain/UniquePtr",
+                                        [] { return UniquePtr<UniqueNode>(new UniqueNode); });
+    DestroyChain<IntrusivePtr<IntrusiveNode>>("chain/IntrusivePtr",
+                                              [] { return MakeIntrusive<IntrusiveNode>(); });
+}
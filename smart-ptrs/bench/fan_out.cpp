@@ -0,0 +1,58 @@
+#include "bench.h"
+
+#include <intrusive/intrusive.h>
+#include <weak/shared.h>
+
+#include <algorithm>
+#include <vector>
+
+// Broadcasting one message to N subscribers: N copies of the pointer, one counter increment each,
+// against `CloneN`, which takes all N references with one increment. Every thread broadcasts the
+// same message, so with more threads the increments contend on one cache line. Subscribers drop
+// their copies one by one in both cases; the time is per subscriber, releases included.
+
+struct Message : SimpleAtomicRefCounted<Message> {
+    int payload = 1;
+};
+
+constexpr size_t kNumSubscriberCopies = 8'000'000;
+
+template <typename Ptr>
+void Broadcast(const char* name, size_t num_threads, size_t num_subscribers, const Ptr& message,
+               bool clone_n) {
+    size_t rounds = kNumSubscriberCopies / num_subscribers / num_threads;
+    double ns = RunThreads(num_threads, [&](size_t) {
+        std::vector<Ptr> subscribers(num_subscribers);
+        for (size_t i = 0; i < rounds; ++i) {
+            if (clone_n) {
+                CloneN(message, subscribers);
+            } else {
+                for (Ptr& subscriber : subscribers) {
+                    subscriber = message;
+                }
+            }
+            DoNotOptimize(subscribers.data());
+            for (Ptr& subscriber : subscribers) {
+                subscriber.Reset();
+            }
+        }
+    });
+    std::printf("N=%-4zu ", num_subscribers);
+    Report(name, num_threads, ns, rounds * num_subscribers * num_threads);
+}
+
+int main() {
+    IntrusivePtr<Message> intrusive(new Message());
+    auto atomic = MakeShared<Message, AtomicCounter>();
+    auto single = MakeShared<Message>();
+    for (size_t subscribers : {8, 64, 512}) {
+        Broadcast("copies, SharedPtr", 1, subscribers, single, false);
+        Broadcast("CloneN, SharedPtr", 1, subscribers, single, true);
+        for (size_t threads = 1; threads <= std::max<size_t>(4, MaxThreads()); threads *= 4) {
+            Broadcast("copies, IntrusivePtr", threads, subscribers, intrusive, false);
+            Broadcast("CloneN, IntrusivePtr", threads, subscribers, intrusive, true);
+            Broadcast("copies, SharedPtr<AtomicCounter>", threads, subscribers, atomic, false);
+            Broadcast("CloneN, SharedPtr<AtomicCounter>", threads, subscribers, atomic, true);
+        }
+    }
+}
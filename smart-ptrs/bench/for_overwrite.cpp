@@ -0,0 +1,37 @@
+#include "bench.h"
+
+#include <unique/unique.h>
+#include <weak/shared.h>
+
+#include <cstring>
+
+// I/O buffers that are filled right after allocation: value-initializing factories zero the
+// buffer first, the `ForOverwrite` ones leave it as it is.
+
+constexpr size_t kTotalBytes = size_t{4} << 30;
+
+template <typename Make>
+void Fill(const char* name, size_t size, Make make) {
+    size_t iters = kTotalBytes / size;
+    double ns = RunThreads(1, [&](size_t) {
+        for (size_t i = 0; i < iters; ++i) {
+            auto buffer = make(size);
+            std::memset(&buffer[0], static_cast<int>(i), size);
+            DoNotOptimize(buffer[size - 1]);
+        }
+    });
+    std::printf("%-40s %6zu KiB %10.0f ns/buffer %6.2f GB/s\n", name, size >> 10, ns / iters,
+                static_cast<double>(size) * iters / ns);
+}
+
+int main() {
+    for (size_t size : {size_t{64} << 10, size_t{1} << 20, size_t{8} << 20}) {
+        Fill("MakeShared<char[]>", size, [](size_t n) { return MakeShared<char[]>(n); });
+        Fill("MakeSharedForOverwrite<char[]>", size,
+             [](size_t n) { return MakeSharedForOverwrite<char[]>(n); });
+        Fill("UniquePtr<char[]>(new char[n]())", size,
+             [](size_t n) { return UniquePtr<char[]>(new char[n]()); });
+        Fill("MakeUniqueForOverwrite<char[]>", size,
+             [](size_t n) { return MakeUniqueForOverwrite<char[]>(n); });
+    }
+}
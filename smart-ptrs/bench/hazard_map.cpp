@@ -0,0 +1,108 @@
+#include "bench.h"
+
+#include <intrusive/hazard_intrusive.h>
+#include <weak/atomic_shared.h>
+#include <weak/hazard_shared.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A read-mostly lock-free hash map: `kBuckets` slots, each with an immutable sorted bucket that a
+// writer replaces as a whole. Thread 0 also writes one operation in `kWriteEvery`; all other
+// operations are lookups. Readers through hazard pointers (`HazardSharedPtr`,
+// `HazardIntrusivePtr`) against counted loads (`AtomicSharedPtr`).
+
+constexpr size_t kBuckets = 64;
+constexpr size_t kKeys = 4096;
+constexpr size_t kOpsPerThread = 1'000'000;
+constexpr size_t kWriteEvery = 100;
+
+struct Bucket : SimpleAtomicRefCounted<Bucket> {
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+
+    explicit Bucket(std::vector<std::pair<uint64_t, uint64_t>> entries)
+        : entries(std::move(entries)) {
+    }
+
+    uint64_t Find(uint64_t key) const {
+        auto it = std::lower_bound(entries.begin(), entries.end(), std::pair(key, uint64_t{0}));
+        return it != entries.end() && it->first == key ? it->second : 0;
+    }
+};
+
+template <typename Slot>
+class Map {
+    static constexpr bool kCounted = std::is_same_v<Slot, AtomicSharedPtr<Bucket>>;
+    static constexpr bool kIntrusive = std::is_same_v<Slot, HazardIntrusivePtr<Bucket>>;
+
+public:
+    Map() {
+        for (uint64_t key = 0; key < kKeys; ++key) {
+            Insert(key, key + 1);
+        }
+    }
+
+    uint64_t Find(uint64_t key, HazardPointer& hazard) const {
+        const Slot& slot = slots_[key % kBuckets];
+        if constexpr (kCounted) {
+            return slot.Load()->Find(key);
+        } else {
+            return slot.Protect(hazard)->Find(key);
+        }
+    }
+
+    // One writer at a time.
+    void Insert(uint64_t key, uint64_t value) {
+        Slot& slot = slots_[key % kBuckets];
+        std::vector<std::pair<uint64_t, uint64_t>> entries;
+        if (auto current = slot.Load()) {
+            entries = current->entries;
+        }
+        auto it = std::lower_bound(entries.begin(), entries.end(), std::pair(key, uint64_t{0}));
+        if (it != entries.end() && it->first == key) {
+            it->second = value;
+        } else {
+            entries.insert(it, {key, value});
+        }
+        if constexpr (kIntrusive) {
+            slot.Store(IntrusivePtr<Bucket>(new Bucket(std::move(entries))));
+        } else {
+            slot.Store(MakeShared<Bucket, AtomicCounter>(std::move(entries)));
+        }
+    }
+
+private:
+    Slot slots_[kBuckets];
+};
+
+template <typename Slot>
+void Lookups(BenchSuite& suite, const char* name) {
+    Map<Slot> map;
+    for (size_t threads : suite.Threads()) {
+        suite.Run(name, threads, kOpsPerThread, [&map](size_t index, size_t ops) {
+            HazardPointer hazard;
+            uint64_t key = index * 7919;
+            uint64_t sum = 0;
+            for (size_t i = 0; i < ops; ++i) {
+                key = (key * 2862933555777941757 + 3037000493) % kKeys;
+                if (index == 0 && i % kWriteEvery == 0) {
+                    map.Insert(key, i);
+                } else {
+                    sum += map.Find(key, hazard);
+                }
+            }
+            DoNotOptimize(sum);
+        });
+    }
+    HazardDomain::Scan();
+}
+
+int main(int argc, char** argv) {
+    BenchSuite suite(argc, argv);
+    Lookups<AtomicSharedPtr<Bucket>>(suite, "map lookup/counted AtomicSharedPtr");
+    Lookups<HazardSharedPtr<Bucket>>(suite, "map lookup/hazard SharedPtr");
+    Lookups<HazardIntrusivePtr<Bucket>>(suite, "map lookup/hazard IntrusivePtr");
+}
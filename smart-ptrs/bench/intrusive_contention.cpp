@@ -0,0 +1,46 @@
+#include "bench.h"
+
+#include <intrusive/intrusive.h>
+#include <weak/shared.h>
+
+#include <vector>
+
+// Threads copying and dropping pointers to one object: every copy is a contended atomic increment
+// and decrement of the same cache line. `IntrusivePtr` with `ThreadSafeCounter` against
+// `SharedPtr` with `AtomicCounter`, and against one object per thread (no contention).
+
+struct Message : SimpleAtomicRefCounted<Message> {
+    int payload = 1;
+};
+
+constexpr size_t kNumIters = 4'000'000;
+constexpr size_t kMaxThreads = 64;
+
+template <typename Ptr>
+void Hammer(const char* name, size_t num_threads, const std::vector<Ptr>& objects) {
+    size_t iters = kNumIters / num_threads;
+    double ns = RunThreads(num_threads, [iters, &objects](size_t index) {
+        const Ptr& object = objects[index % objects.size()];
+        for (size_t i = 0; i < iters; ++i) {
+            Ptr copy = object;
+            DoNotOptimize(copy);
+        }
+    });
+    Report(name, num_threads, ns, iters * num_threads);
+}
+
+int main() {
+    using Intrusive = IntrusivePtr<Message>;
+    using Shared = SharedPtr<Message, AtomicCounter>;
+    for (size_t threads = 1; threads <= kMaxThreads; threads *= 2) {
+        std::vector<Intrusive> one_intrusive{Intrusive(new Message())};
+        std::vector<Shared> one_shared{MakeShared<Message, AtomicCounter>()};
+        std::vector<Intrusive> own_objects;
+        for (size_t i = 0; i < threads; ++i) {
+            own_objects.emplace_back(new Message());
+        }
+        Hammer("copies of one object, IntrusivePtr", threads, one_intrusive);
+        Hammer("copies of one object, SharedPtr<AtomicCounter>", threads, one_shared);
+        Hammer("an object per thread, IntrusivePtr", threads, own_objects);
+    }
+}
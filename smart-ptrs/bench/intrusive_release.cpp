@@ -0,0 +1,60 @@
+#include "bench.h"
+
+#include <intrusive/intrusive.h>
+
+#include <chrono>
+
+// Cost of a non-final `DecRef`: the current single read-modify-write against the previous
+// version, which read the count twice before decrementing it (reproduced below).
+
+template <typename Derived, typename Counter>
+class TwoReadRefCounted {
+public:
+    void IncRef() {
+        counter_.IncRef();
+    }
+
+    void DecRef() {
+        if (counter_.RefCount() == 0 || counter_.RefCount() == 1) {
+            delete static_cast<Derived*>(this);
+        } else {
+            counter_.DecRef();
+        }
+    }
+
+private:
+    Counter counter_;
+};
+
+template <typename Counter>
+struct Current : RefCounted<Current<Counter>, Counter, DefaultDelete> {};
+
+template <typename Counter>
+struct TwoReads : TwoReadRefCounted<TwoReads<Counter>, Counter> {};
+
+constexpr size_t kNumIters = 50'000'000;
+
+// Takes `kNumIters` references up front, then times releasing them.
+template <typename Object>
+void Release(const char* name) {
+    auto* object = new Object();
+    object->IncRef();
+    for (size_t i = 0; i < kNumIters; ++i) {
+        object->IncRef();
+    }
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kNumIters; ++i) {
+        DoNotOptimize(object);
+        object->DecRef();
+    }
+    auto end = std::chrono::steady_clock::now();
+    Report(name, 1, std::chrono::duration<double, std::nano>(end - begin).count(), kNumIters);
+    object->DecRef();
+}
+
+int main() {
+    Release<TwoReads<SimpleCounter>>("release, two reads, SimpleCounter");
+    Release<Current<SimpleCounter>>("release, one RMW, SimpleCounter");
+    Release<TwoReads<ThreadSafeCounter>>("release, two reads, ThreadSafeCounter");
+    Release<Current<ThreadSafeCounter>>("release, one RMW, ThreadSafeCounter");
+}
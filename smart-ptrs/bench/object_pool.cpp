@@ -0,0 +1,87 @@
+#include "bench.h"
+
+#include <intrusive/object_pool.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+// Messages created on one thread and released on another: `ObjectPool` against `new`/`delete`
+// (`MakeIntrusive`). Every thread fills a batch, then hands it to its neighbour, which drops it,
+// so with two or more threads every release takes the cross-thread path. Also counts the calls
+// to `operator new` made while creating messages once the pool is warm.
+
+static thread_local size_t num_allocations = 0;
+
+void* operator new(size_t size) {
+    ++num_allocations;
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+struct Message : ObjectInPool<Message> {
+    explicit Message(size_t id) : id(id) {
+    }
+
+    size_t id;
+    char payload[48];
+};
+
+struct PlainMessage : SimpleAtomicRefCounted<PlainMessage> {
+    explicit PlainMessage(size_t id) : id(id) {
+    }
+
+    size_t id;
+    char payload[48];
+};
+
+constexpr size_t kNumIters = 2'000'000;
+constexpr size_t kBatch = 20'000;
+
+template <typename Ptr, typename Make>
+void Handoff(const char* name, size_t num_threads, Make make) {
+    std::vector<std::vector<Ptr>> batches(num_threads);
+    for (auto& batch : batches) {
+        batch.reserve(kBatch);
+    }
+    std::atomic<size_t> allocations = 0;
+    double ns = 0;
+    for (size_t done = 0; done < kNumIters; done += kBatch * num_threads) {
+        bool warm = done > 0;
+        ns += RunThreads(num_threads, [&, warm](size_t index) {
+            size_t before = num_allocations;
+            for (size_t i = 0; i < kBatch; ++i) {
+                batches[index].push_back(make(i));
+            }
+            if (warm) {
+                allocations += num_allocations - before;
+            }
+        });
+        ns += RunThreads(num_threads, [&batches, num_threads](size_t index) {
+            batches[(index + 1) % num_threads].clear();
+        });
+    }
+    Report(name, num_threads, ns, kNumIters);
+    std::printf("%-48s %zu allocations after warm-up\n", "", allocations.load());
+}
+
+int main() {
+    ObjectPool<Message> pool;
+    for (size_t threads = 1; threads <= std::max<size_t>(2, MaxThreads()); threads *= 2) {
+        Handoff<IntrusivePtr<Message>>("handoff, ObjectPool", threads,
+                                       [&pool](size_t id) { return pool.Allocate(id); });
+        Handoff<IntrusivePtr<PlainMessage>>("handoff, new/delete", threads, [](size_t id) {
+            return MakeIntrusive<PlainMessage>(id);
+        });
+    }
+}
@@ -0,0 +1,110 @@
+#include "bench.h"
+
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+// Copy/destroy loops on the packed strong/weak word against two separate atomic counters
+// (the previous `AtomicCounter` layout, reproduced here as a policy).
+
+class SplitAtomicCounter {
+public:
+    void IncreaseShared() {
+        shared_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool DecreaseShared() {
+        return shared_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    bool TryIncreaseShared() {
+        size_t count = shared_.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (shared_.compare_exchange_weak(count, count + 1, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void IncreaseWeak() {
+        weak_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool DecreaseWeak() {
+        return weak_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    size_t GetShared() const {
+        return shared_.load(std::memory_order_relaxed);
+    }
+
+    size_t GetWeak() const {
+        return weak_.load(std::memory_order_relaxed) - (GetShared() > 0 ? 1 : 0);
+    }
+
+private:
+    std::atomic<size_t> shared_ = 1;
+    std::atomic<size_t> weak_ = 1;
+};
+
+constexpr size_t kNumIters = 10'000'000;
+
+template <typename Counter>
+void CopyShared(const char* name) {
+    auto sp = MakeShared<int, Counter>(42);
+    double ns = RunThreads(1, [&sp](size_t) {
+        for (size_t i = 0; i < kNumIters; ++i) {
+            SharedPtr<int, Counter> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+    Report(name, 1, ns, kNumIters);
+}
+
+template <typename Counter>
+void CopyWeak(const char* name) {
+    auto sp = MakeShared<int, Counter>(42);
+    WeakPtr<int, Counter> wp(sp);
+    double ns = RunThreads(1, [&wp](size_t) {
+        for (size_t i = 0; i < kNumIters; ++i) {
+            WeakPtr<int, Counter> copy(wp);
+            DoNotOptimize(copy);
+        }
+    });
+    Report(name, 1, ns, kNumIters);
+}
+
+template <typename Counter>
+void CreateRelease(const char* name) {
+    double ns = RunThreads(1, [](size_t) {
+        for (size_t i = 0; i < kNumIters; ++i) {
+            auto sp = MakeShared<int, Counter>(42);
+            DoNotOptimize(sp);
+        }
+    });
+    Report(name, 1, ns, kNumIters);
+}
+
+template <typename Counter>
+void CreateReleaseWithWeak(const char* name) {
+    double ns = RunThreads(1, [](size_t) {
+        for (size_t i = 0; i < kNumIters; ++i) {
+            auto sp = MakeShared<int, Counter>(42);
+            WeakPtr<int, Counter> wp(sp);
+            sp.Reset();
+            DoNotOptimize(wp);
+        }
+    });
+    Report(name, 1, ns, kNumIters);
+}
+
+int main() {
+    CopyShared<SplitAtomicCounter>("copy shared/split");
+    CopyShared<AtomicCounter>("copy shared/packed");
+    CopyWeak<SplitAtomicCounter>("copy weak/split");
+    CopyWeak<AtomicCounter>("copy weak/packed");
+    CreateRelease<SplitAtomicCounter>("make + last release/split");
+    CreateRelease<AtomicCounter>("make + last release/packed");
+    CreateReleaseWithWeak<SplitAtomicCounter>("make + weak + last releases/split");
+    CreateReleaseWithWeak<AtomicCounter>("make + weak + last releases/packed");
+}
@@ -0,0 +1,102 @@
+#include "bench.h"
+
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+#include <unordered_map>
+#include <vector>
+
+// An object registering callbacks that keep it alive (or watch it) from inside a member
+// function: `SharedFromThis`, `WeakFromThis` locked when the callback fires, and, without
+// `EnableSharedFromThis`, a registry mapping `this` to a `WeakPtr`. A registration stores the
+// captured pointer, firing the callbacks drops them.
+
+struct Widget : public EnableSharedFromThis<Widget, AtomicCounter> {
+    int clicks = 0;
+};
+
+using Ptr = SharedPtr<Widget, AtomicCounter>;
+using Weak = WeakPtr<Widget, AtomicCounter>;
+
+constexpr size_t kNumIters = 10'000'000;
+constexpr size_t kBatch = 64;
+
+struct FromThis {
+    std::vector<Ptr> callbacks;
+
+    void Register(Widget* widget) {
+        callbacks.push_back(widget->SharedFromThis());
+    }
+
+    void Fire() {
+        for (auto& callback : callbacks) {
+            ++callback->clicks;
+        }
+        callbacks.clear();
+    }
+};
+
+struct WeakFromThis {
+    std::vector<Weak> callbacks;
+
+    void Register(Widget* widget) {
+        callbacks.push_back(widget->WeakFromThis());
+    }
+
+    void Fire() {
+        for (auto& callback : callbacks) {
+            if (auto widget = callback.Lock()) {
+                ++widget->clicks;
+            }
+        }
+        callbacks.clear();
+    }
+};
+
+struct Registry {
+    std::unordered_map<const Widget*, Weak> owners;
+    std::vector<Ptr> callbacks;
+
+    void Register(Widget* widget) {
+        callbacks.push_back(owners.find(widget)->second.Lock());
+    }
+
+    void Fire() {
+        for (auto& callback : callbacks) {
+            ++callback->clicks;
+        }
+        callbacks.clear();
+    }
+};
+
+template <typename Callbacks>
+void Run(const char* name, size_t num_threads) {
+    size_t iters = kNumIters / num_threads;
+    double ns = RunThreads(num_threads, [iters](size_t) {
+        std::vector<Ptr> widgets;
+        Callbacks callbacks;
+        for (int i = 0; i < 1000; ++i) {
+            widgets.push_back(MakeShared<Widget, AtomicCounter>());
+            if constexpr (std::is_same_v<Callbacks, Registry>) {
+                callbacks.owners.emplace(widgets.back().Get(), widgets.back());
+            }
+        }
+        callbacks.callbacks.reserve(kBatch);
+        for (size_t done = 0; done < iters; done += kBatch) {
+            for (size_t i = 0; i < kBatch; ++i) {
+                callbacks.Register(widgets[(done + i) % widgets.size()].Get());
+            }
+            callbacks.Fire();
+        }
+        DoNotOptimize(widgets[0]->clicks);
+    });
+    Report(name, num_threads, ns, iters * num_threads);
+}
+
+int main() {
+    for (size_t threads = 1; threads <= MaxThreads(); threads *= 2) {
+        Run<FromThis>("register + fire, SharedFromThis", threads);
+        Run<WeakFromThis>("register + fire, WeakFromThis + Lock", threads);
+        Run<Registry>("register + fire, this -> WeakPtr map", threads);
+    }
+}
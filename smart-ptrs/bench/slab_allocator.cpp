@@ -0,0 +1,100 @@
+#include "bench.h"
+
+#include <weak/shared.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Control block churn: blocks from the per-thread slab (`MakeShared`, `SharedPtr(new T)`)
+// against the same blocks from glibc malloc (`AllocateShared` and a deleter with
+// `std::allocator`).
+
+using Ptr = SharedPtr<int, AtomicCounter>;
+
+constexpr size_t kNumIters = 10'000'000;
+constexpr size_t kBatch = 100'000;
+
+struct Slab {
+    static Ptr Make(int value) {
+        return MakeShared<int, AtomicCounter>(value);
+    }
+
+    static Ptr Own(int* ptr) {
+        return Ptr(ptr);
+    }
+};
+
+struct Malloc {
+    static Ptr Make(int value) {
+        return AllocateShared<int, AtomicCounter>(std::allocator<int>(), value);
+    }
+
+    static Ptr Own(int* ptr) {
+        return Ptr(ptr, std::default_delete<int>());
+    }
+};
+
+// Create and destroy one pointer at a time: the free list stays hot.
+template <typename Source>
+void OneByOne(const char* name, size_t num_threads) {
+    size_t iters = kNumIters / num_threads;
+    double ns = RunThreads(num_threads, [iters](size_t) {
+        for (size_t i = 0; i < iters; ++i) {
+            Ptr ptr = Source::Make(static_cast<int>(i));
+            DoNotOptimize(ptr);
+        }
+    });
+    Report(name, num_threads, ns, iters * num_threads);
+}
+
+// Build up a batch, then drop it: blocks come from fresh slab space and go back out of order.
+template <typename Source>
+void Batches(const char* name, size_t num_threads) {
+    size_t iters = kNumIters / num_threads;
+    double ns = RunThreads(num_threads, [iters](size_t) {
+        std::vector<Ptr> batch;
+        batch.reserve(kBatch);
+        for (size_t done = 0; done < iters; done += kBatch) {
+            for (size_t i = 0; i < kBatch; ++i) {
+                batch.push_back(i % 2 == 0 ? Source::Make(i) : Source::Own(new int(i)));
+            }
+            for (size_t i = 0; i < kBatch; i += 2) {
+                batch[i].Reset();
+            }
+            batch.clear();
+        }
+    });
+    Report(name, num_threads, ns, iters * num_threads);
+}
+
+// Every thread releases the blocks its neighbour created: all frees take the remote path.
+template <typename Source>
+void RemoteFree(const char* name, size_t num_threads) {
+    std::vector<std::vector<Ptr>> batches(num_threads);
+    double ns = 0;
+    for (size_t done = 0; done < kNumIters; done += kBatch * num_threads) {
+        ns += RunThreads(num_threads, [&batches](size_t index) {
+            for (size_t i = 0; i < kBatch; ++i) {
+                batches[index].push_back(Source::Make(i));
+            }
+        });
+        ns += RunThreads(num_threads, [&batches, num_threads](size_t index) {
+            batches[(index + 1) % num_threads].clear();
+        });
+    }
+    Report(name, num_threads, ns, kNumIters);
+}
+
+int main() {
+    for (size_t threads = 1; threads <= MaxThreads(); threads *= 2) {
+        OneByOne<Slab>("create/destroy, slab", threads);
+        OneByOne<Malloc>("create/destroy, malloc", threads);
+        Batches<Slab>("batches, slab", threads);
+        Batches<Malloc>("batches, malloc", threads);
+    }
+    for (size_t threads = 2; threads <= std::max<size_t>(2, MaxThreads()); threads *= 2) {
+        RemoteFree<Slab>("remote free, slab", threads);
+        RemoteFree<Malloc>("remote free, malloc", threads);
+    }
+}
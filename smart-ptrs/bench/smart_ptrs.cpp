@@ -0,0 +1,180 @@
+#include "bench.h"
+
+#include <intrusive/intrusive.h>
+#include <unique/unique.h>
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+// The whole public surface against the `std::` pointers, for comparing builds of this library:
+//
+//     bench_smart_ptrs --json=before.json
+//     ... upgrade ...
+//     bench_smart_ptrs --json=after.json
+//
+// Allocating operations run for several object sizes. Every thread works on its own objects,
+// except the "contended" cases, where all threads copy or lock one object.
+
+constexpr size_t kOpsPerThread = 200'000;
+
+template <size_t kSize>
+struct Payload {
+    char bytes[kSize] = {};
+};
+
+struct Node : SimpleRefCounted<Node> {
+    int value = 0;
+};
+
+struct AtomicNode : SimpleAtomicRefCounted<AtomicNode> {
+    int value = 0;
+};
+
+// One object per thread, or one for all of them.
+template <typename Ptr, typename Make>
+std::vector<Ptr> Objects(size_t num_threads, bool contended, Make make) {
+    std::vector<Ptr> objects;
+    for (size_t i = 0; i < (contended ? 1 : num_threads); ++i) {
+        objects.push_back(make());
+    }
+    return objects;
+}
+
+template <typename Ptr, typename Make>
+void Copy(BenchSuite& suite, const std::string& name, size_t threads, bool contended, Make make) {
+    auto objects = Objects<Ptr>(threads, contended, make);
+    suite.Run(name, threads, kOpsPerThread, [&](size_t index, size_t ops) {
+        const Ptr& object = objects[index % objects.size()];
+        for (size_t i = 0; i < ops; ++i) {
+            Ptr copy = object;
+            DoNotOptimize(copy);
+        }
+    });
+}
+
+// One op is a move there and back.
+template <typename Ptr, typename Make>
+void Move(BenchSuite& suite, const std::string& name, size_t threads, Make make) {
+    auto objects = Objects<Ptr>(threads, false, make);
+    suite.Run(name, threads, kOpsPerThread, [&](size_t index, size_t ops) {
+        Ptr& object = objects[index];
+        for (size_t i = 0; i < ops; ++i) {
+            Ptr moved = std::move(object);
+            object = std::move(moved);
+            DoNotOptimize(object);
+        }
+    });
+}
+
+// Creation and destruction.
+template <typename Make>
+void Create(BenchSuite& suite, const std::string& name, size_t threads, Make make) {
+    suite.Run(name, threads, kOpsPerThread, [&](size_t, size_t ops) {
+        for (size_t i = 0; i < ops; ++i) {
+            auto created = make();
+            DoNotOptimize(created);
+        }
+    });
+}
+
+// `lock(weak)` while the object is alive.
+template <typename Ptr, typename Weak, typename Make, typename Lock>
+void WeakLock(BenchSuite& suite, const std::string& name, size_t threads, bool contended,
+              Make make, Lock lock) {
+    auto objects = Objects<Ptr>(threads, contended, make);
+    suite.Run(name, threads, kOpsPerThread, [&](size_t index, size_t ops) {
+        Weak weak(objects[index % objects.size()]);
+        for (size_t i = 0; i < ops; ++i) {
+            auto locked = lock(weak);
+            DoNotOptimize(locked);
+        }
+    });
+}
+
+template <size_t kSize>
+void Allocating(BenchSuite& suite, size_t threads) {
+    using T = Payload<kSize>;
+    std::string size = " " + std::to_string(kSize) + "B";
+    Create(suite, "UniquePtr/Reset(new)" + size, threads, [] {
+        UniquePtr<T> ptr;
+        ptr.Reset(new T());
+        return ptr;
+    });
+    Create(suite, "std::unique_ptr/reset(new)" + size, threads, [] {
+        std::unique_ptr<T> ptr;
+        ptr.reset(new T());
+        return ptr;
+    });
+    Create(suite, "MakeShared" + size, threads, [] { return MakeShared<T>(); });
+    Create(suite, "MakeShared<AtomicCounter>" + size, threads,
+           [] { return MakeShared<T, AtomicCounter>(); });
+    Create(suite, "std::make_shared" + size, threads, [] { return std::make_shared<T>(); });
+    Create(suite, "SharedPtr(new)" + size, threads, [] { return SharedPtr<T>(new T()); });
+    Create(suite, "std::shared_ptr(new)" + size, threads,
+           [] { return std::shared_ptr<T>(new T()); });
+    Create(suite, "MakeShared+WeakPtr" + size, threads, [] {
+        auto ptr = MakeShared<T>();
+        return WeakPtr<T>(ptr);
+    });
+    Create(suite, "std::make_shared+weak_ptr" + size, threads, [] {
+        auto ptr = std::make_shared<T>();
+        return std::weak_ptr<T>(ptr);
+    });
+}
+
+void NonAllocating(BenchSuite& suite, size_t threads) {
+    using Single = SharedPtr<int>;
+    using Atomic = SharedPtr<int, AtomicCounter>;
+    auto single = [] { return MakeShared<int>(1); };
+    auto atomic = [] { return MakeShared<int, AtomicCounter>(1); };
+    auto standard = [] { return std::make_shared<int>(1); };
+    auto node = [] { return MakeIntrusive<Node>(); };
+    auto atomic_node = [] { return MakeIntrusive<AtomicNode>(); };
+    auto unique = [] { return UniquePtr<int>(new int(1)); };
+
+    Copy<Single>(suite, "SharedPtr/copy", threads, false, single);
+    Copy<Atomic>(suite, "SharedPtr<AtomicCounter>/copy", threads, false, atomic);
+    Copy<std::shared_ptr<int>>(suite, "std::shared_ptr/copy", threads, false, standard);
+    Copy<IntrusivePtr<Node>>(suite, "IntrusivePtr/copy", threads, false, node);
+    Copy<IntrusivePtr<AtomicNode>>(suite, "IntrusivePtr<ThreadSafeCounter>/copy", threads, false,
+                                   atomic_node);
+    Copy<Atomic>(suite, "SharedPtr<AtomicCounter>/copy contended", threads, true, atomic);
+    Copy<std::shared_ptr<int>>(suite, "std::shared_ptr/copy contended", threads, true, standard);
+    Copy<IntrusivePtr<AtomicNode>>(suite, "IntrusivePtr<ThreadSafeCounter>/copy contended",
+                                   threads, true, atomic_node);
+
+    Move<Single>(suite, "SharedPtr/move", threads, single);
+    Move<std::shared_ptr<int>>(suite, "std::shared_ptr/move", threads, standard);
+    Move<IntrusivePtr<Node>>(suite, "IntrusivePtr/move", threads, node);
+    Move<UniquePtr<int>>(suite, "UniquePtr/move", threads, unique);
+    Move<std::unique_ptr<int>>(suite, "std::unique_ptr/move", threads,
+                               [] { return std::make_unique<int>(1); });
+
+    auto lock = [](const auto& weak) { return weak.Lock(); };
+    auto std_lock = [](const std::weak_ptr<int>& weak) { return weak.lock(); };
+    WeakLock<Single, WeakPtr<int>>(suite, "WeakPtr/Lock", threads, false, single, lock);
+    WeakLock<Atomic, WeakPtr<int, AtomicCounter>>(suite, "WeakPtr<AtomicCounter>/Lock", threads,
+                                                  false, atomic, lock);
+    WeakLock<std::shared_ptr<int>, std::weak_ptr<int>>(suite, "std::weak_ptr/lock", threads,
+                                                       false, standard, std_lock);
+    WeakLock<Atomic, WeakPtr<int, AtomicCounter>>(
+        suite, "WeakPtr<AtomicCounter>/Lock contended", threads, true, atomic, lock);
+    WeakLock<std::shared_ptr<int>, std::weak_ptr<int>>(
+        suite, "std::weak_ptr/lock contended", threads, true, standard, std_lock);
+
+    Create(suite, "MakeIntrusive", threads, node);
+    Create(suite, "MakeIntrusive<ThreadSafeCounter>", threads, atomic_node);
+}
+
+int main(int argc, char** argv) {
+    BenchSuite suite(argc, argv);
+    for (size_t threads : suite.Threads()) {
+        NonAllocating(suite, threads);
+        Allocating<8>(suite, threads);
+        Allocating<64>(suite, threads);
+        Allocating<1024>(suite, threads);
+    }
+}
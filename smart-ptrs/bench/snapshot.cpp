@@ -0,0 +1,66 @@
+#include "bench.h"
+
+#include <weak/atomic_shared.h>
+#include <weak/snapshot.h>
+
+#include <cstdint>
+
+// Readers of one shared config on 1 .. all hardware threads: a copy of a `SharedPtr` (the
+// contended counter this is about), `AtomicSharedPtr::Load` and `Snapshot::Read`. Thread 0 also
+// publishes a new config every `kPublishEvery` reads in the last two.
+
+struct Config {
+    int64_t version;
+    char payload[56];
+};
+
+using Ptr = SharedPtr<Config, AtomicCounter>;
+
+constexpr size_t kReadsPerThread = 2'000'000;
+constexpr size_t kPublishEvery = 100'000;
+
+Ptr MakeConfig(int64_t version) {
+    return MakeShared<Config, AtomicCounter>(Config{version, {}});
+}
+
+int main(int argc, char** argv) {
+    BenchSuite suite(argc, argv);
+    for (size_t threads : suite.Threads()) {
+        const Ptr shared = MakeConfig(0);
+        suite.Run("read config/copy SharedPtr", threads, kReadsPerThread,
+                  [&shared](size_t, size_t ops) {
+                      int64_t sum = 0;
+                      for (size_t i = 0; i < ops; ++i) {
+                          Ptr config = shared;
+                          sum += config->version;
+                      }
+                      DoNotOptimize(sum);
+                  });
+
+        AtomicSharedPtr<Config> atomic(MakeConfig(0));
+        suite.Run("read config/AtomicSharedPtr", threads, kReadsPerThread,
+                  [&atomic](size_t index, size_t ops) {
+                      int64_t sum = 0;
+                      for (size_t i = 0; i < ops; ++i) {
+                          if (index == 0 && i % kPublishEvery == 0) {
+                              atomic.Store(MakeConfig(i));
+                          }
+                          sum += atomic.Load()->version;
+                      }
+                      DoNotOptimize(sum);
+                  });
+
+        Snapshot<Config> snapshot(MakeConfig(0));
+        suite.Run("read config/Snapshot", threads, kReadsPerThread,
+                  [&snapshot](size_t index, size_t ops) {
+                      int64_t sum = 0;
+                      for (size_t i = 0; i < ops; ++i) {
+                          if (index == 0 && i % kPublishEvery == 0) {
+                              snapshot.Publish(MakeConfig(i));
+                          }
+                          sum += snapshot.Read()->version;
+                      }
+                      DoNotOptimize(sum);
+                  });
+    }
+}
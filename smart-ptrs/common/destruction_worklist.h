@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Turns recursive destruction into a loop.
+//
+// Releasing the last pointer to the head of a linked structure (`struct Node { SharedPtr<Node>
+// next; }`) destroys the next node from inside the destructor of the head, and so on down the
+// chain: one stack frame per node. Smart pointers hand their final destruction to `Run` instead.
+// The outermost call destroys its object right away; calls made while it is running (from
+// destructors) only queue their objects, and the outermost call destroys them one by one once the
+// current destructor has returned. The stack depth stays constant for any chain length.
+//
+// An object released from inside a destructor is therefore destroyed a little later than the
+// release, but before the outermost release returns.
+class DestructionWorklist {
+public:
+    using Destroy = void (*)(void*);
+
+    static void Run(void* object, Destroy destroy) {
+        if (current != nullptr) {
+            current->push_back(Entry{object, destroy});
+            return;
+        }
+        std::vector<Entry> pending;
+        current = &pending;
+        destroy(object);
+        while (!pending.empty()) {
+            Entry entry = pending.back();
+            pending.pop_back();
+            entry.destroy(entry.object);
+        }
+        current = nullptr;
+    }
+
+private:
+    struct Entry {
+        void* object;
+        Destroy destroy;
+    };
+
+    // Points to the worklist of the outermost `Run` on this thread, if any. A plain pointer keeps
+    // the check free of thread-local initialization and destructor registration.
+    static inline thread_local std::vector<Entry>* current = nullptr;
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Hazard pointers (Michael, "Hazard Pointers: Safe Memory Reclamation for Lock-Free Objects",
+// 2004) for lock-free structures: readers reach shared objects without touching their counters.
+//
+//     HazardPointer hazard;
+//     Node* node = hazard.Protect(head);  // Stays valid until `hazard` protects something else
+//
+// A writer that unlinks an object retires it instead of freeing it: `HazardDomain::Retire(ptr,
+// reclaim)` calls `reclaim(ptr)` once no hazard pointer protects `ptr`. Retired pointers are
+// collected per thread and checked against all hazard pointers in batches, so a retirement costs
+// O(1) amortized.
+//
+// Hazard pointers are slots in a global list that only grows; a thread keeps a few released slots
+// at hand, so creating a `HazardPointer` usually takes no atomic read-modify-write. When a thread
+// exits, whatever it retired and could not reclaim yet goes to the next scan on any thread.
+class HazardPointer;
+
+class HazardDomain {
+public:
+    using Reclaim = void (*)(void*);
+
+    // `ptr` must be unreachable for new readers already.
+    static void Retire(void* ptr, Reclaim reclaim) {
+        Local& local = GetLocal();
+        if (local.exited) [[unlikely]] {
+            Registry& registry = Registry::Instance();
+            std::lock_guard lock(registry.mutex);
+            registry.orphans.push_back(Retired{ptr, reclaim});
+            registry.has_orphans.store(true, std::memory_order_relaxed);
+            return;
+        }
+        local.retired.push_back(Retired{ptr, reclaim});
+        if (local.retired.size() >= ScanThreshold()) {
+            Scan();
+        }
+    }
+
+    // Reclaims what this thread and exited threads retired and no hazard pointer protects.
+    // Returns how many pointers this thread still has to wait for.
+    static size_t Scan() {
+        Local& local = GetLocal();
+        if (local.exited) [[unlikely]] {
+            return 0;
+        }
+        Registry& registry = Registry::Instance();
+        if (registry.has_orphans.load(std::memory_order_relaxed)) {
+            std::lock_guard lock(registry.mutex);
+            local.retired.insert(local.retired.end(), registry.orphans.begin(),
+                                 registry.orphans.end());
+            registry.orphans.clear();
+            registry.has_orphans.store(false, std::memory_order_relaxed);
+        }
+        // Pairs with the fence in `Protect`: either the reader sees that its pointer was
+        // unlinked and retries, or this scan sees its hazard.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<const void*> hazards;
+        for (Record* record = registry.records.load(std::memory_order_acquire); record != nullptr;
+             record = record->next) {
+            // Acquire: a reader's accesses happen before it moves its hazard pointer away.
+            if (const void* hazard = record->hazard.load(std::memory_order_acquire)) {
+                hazards.push_back(hazard);
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+        // Reclaiming may retire more pointers: they go to a fresh list.
+        std::vector<Retired> retired = std::move(local.retired);
+        local.retired.clear();
+        std::vector<Retired> kept;
+        for (const Retired& entry : retired) {
+            if (std::binary_search(hazards.begin(), hazards.end(), entry.ptr)) {
+                kept.push_back(entry);
+            } else {
+                entry.reclaim(entry.ptr);
+            }
+        }
+        local.retired.insert(local.retired.end(), kept.begin(), kept.end());
+        return local.retired.size();
+    }
+
+    // Retired on this thread and not reclaimed yet.
+    static size_t NumRetired() {
+        Local& local = GetLocal();
+        return local.exited ? 0 : local.retired.size();
+    }
+
+private:
+    friend class HazardPointer;
+
+    static constexpr size_t kCachedRecords = 8;
+    static constexpr size_t kMinScanThreshold = 64;
+
+    struct alignas(64) Record {
+        std::atomic<const void*> hazard = nullptr;
+        std::atomic<bool> active = true;
+        Record* next = nullptr;
+    };
+
+    struct Retired {
+        void* ptr;
+        Reclaim reclaim;
+    };
+
+    struct Registry {
+        std::atomic<Record*> records = nullptr;
+        std::atomic<size_t> num_records = 0;
+        std::mutex mutex;
+        std::vector<Retired> orphans;
+        std::atomic<bool> has_orphans = false;
+
+        // Never destroyed: records may be used during static destruction too.
+        static Registry& Instance() {
+            static Registry& registry = *new Registry();
+            return registry;
+        }
+    };
+
+    struct Local {
+        Record* cache[kCachedRecords];
+        size_t num_cached = 0;
+        std::vector<Retired> retired;
+        bool exited = false;
+
+        ~Local() {
+            Scan();
+            for (size_t i = 0; i < num_cached; ++i) {
+                cache[i]->active.store(false, std::memory_order_release);
+            }
+            num_cached = 0;
+            if (!retired.empty()) {
+                Registry& registry = Registry::Instance();
+                std::lock_guard lock(registry.mutex);
+                registry.orphans.insert(registry.orphans.end(), retired.begin(), retired.end());
+                registry.has_orphans.store(true, std::memory_order_relaxed);
+            }
+            exited = true;
+        }
+    };
+
+    static Local& GetLocal() {
+        static thread_local Local local;
+        return local;
+    }
+
+    // Large enough that a scan reclaims at least half of what it looks at.
+    static size_t ScanThreshold() {
+        size_t records = Registry::Instance().num_records.load(std::memory_order_relaxed);
+        return std::max(kMinScanThreshold, 2 * records);
+    }
+
+    static Record* Acquire() {
+        Local& local = GetLocal();
+        if (local.num_cached > 0 && !local.exited) [[likely]] {
+            return local.cache[--local.num_cached];
+        }
+        Registry& registry = Registry::Instance();
+        for (Record* record = registry.records.load(std::memory_order_acquire); record != nullptr;
+             record = record->next) {
+            if (!record->active.load(std::memory_order_relaxed) &&
+                !record->active.exchange(true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+        auto* record = new Record();
+        registry.num_records.fetch_add(1, std::memory_order_relaxed);
+        Record* head = registry.records.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!registry.records.compare_exchange_weak(head, record, std::memory_order_release,
+                                                         std::memory_order_relaxed));
+        return record;
+    }
+
+    static void Release(Record* record) {
+        record->hazard.store(nullptr, std::memory_order_release);
+        Local& local = GetLocal();
+        if (local.num_cached < kCachedRecords && !local.exited) [[likely]] {
+            local.cache[local.num_cached++] = record;
+        } else {
+            record->active.store(false, std::memory_order_release);
+        }
+    }
+};
+
+// One protected pointer at a time. Not thread-safe: each reader uses its own.
+class HazardPointer {
+public:
+    HazardPointer() {
+        record_ = HazardDomain::Acquire();
+    }
+
+    HazardPointer(const HazardPointer&) = delete;
+    HazardPointer& operator=(const HazardPointer&) = delete;
+
+    ~HazardPointer() {
+        HazardDomain::Release(record_);
+    }
+
+    // Loads `source` and protects the result: it will not be reclaimed until this hazard pointer
+    // is reset, protects another pointer or is destroyed.
+    template <typename T>
+    T* Protect(const std::atomic<T*>& source) {
+        T* ptr = source.load(std::memory_order_relaxed);
+        while (true) {
+            // Release: accesses through the previously protected pointer are done.
+            record_->hazard.store(ptr, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            T* current = source.load(std::memory_order_acquire);
+            if (current == ptr) {
+                return ptr;
+            }
+            ptr = current;
+        }
+    }
+
+    void Reset() {
+        record_->hazard.store(nullptr, std::memory_order_release);
+    }
+
+private:
+    HazardDomain::Record* record_;
+};
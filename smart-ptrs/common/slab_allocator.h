@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Size-class slab allocator for small, short-lived objects such as control blocks.
+//
+// Every thread allocates from its own heap: one free list per size class, filled from 64 KiB
+// slabs. A block freed by its owner thread goes straight back to that free list; a block freed
+// by any other thread is pushed onto the owner's lock-free return stack, which the owner drains
+// once its free list runs dry. The owning heap is found from the slab header at the aligned
+// start of the slab.
+//
+// Heaps outlive their threads: an exited thread's heap is handed over to the next new thread.
+// Slabs are never returned to the system.
+class SlabAllocator {
+public:
+    static constexpr size_t kAlignment = 16;
+    static constexpr size_t kMaxSize = 256;
+
+    static void* Allocate(size_t size) {
+        if (size > kMaxSize) {
+            return ::operator new(size);
+        }
+        size_t size_class = SizeClass(size);
+        Heap* heap = current_heap;
+        if (heap != nullptr) [[likely]] {
+            return heap->Pop(size_class);
+        }
+        return AllocateSlow(size_class);
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        if (size > kMaxSize) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto* block = static_cast<FreeBlock*>(ptr);
+        Slab* slab = Slab::Of(ptr);
+        Heap* heap = slab->heap;
+        if (heap == current_heap) [[likely]] {
+            block->next = heap->free[slab->size_class];
+            heap->free[slab->size_class] = block;
+        } else {
+            heap->Return(slab->size_class, block);
+        }
+    }
+
+private:
+    static constexpr size_t kNumClasses = kMaxSize / kAlignment;
+    static constexpr size_t kSlabSize = 64 * 1024;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Heap;
+
+    struct alignas(kAlignment) Slab {
+        Heap* heap;
+        size_t size_class;
+
+        static Slab* Of(void* ptr) {
+            return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(kSlabSize - 1));
+        }
+    };
+
+    struct Heap {
+        FreeBlock* free[kNumClasses] = {};
+        char* bump[kNumClasses] = {};
+        char* bump_end[kNumClasses] = {};
+        std::atomic<FreeBlock*> returned[kNumClasses] = {};
+
+        void* Pop(size_t size_class) {
+            if (FreeBlock* block = free[size_class]) [[likely]] {
+                free[size_class] = block->next;
+                return block;
+            }
+            return Refill(size_class);
+        }
+
+        // Takes the blocks freed by other threads, or else a fresh piece of the slab.
+        void* Refill(size_t size_class) {
+            FreeBlock* block = returned[size_class].exchange(nullptr, std::memory_order_acquire);
+            if (block != nullptr) {
+                free[size_class] = block->next;
+                return block;
+            }
+            size_t block_size = (size_class + 1) * kAlignment;
+            if (bump[size_class] + block_size > bump_end[size_class]) {
+                void* memory = std::aligned_alloc(kSlabSize, kSlabSize);
+                if (memory == nullptr) {
+                    throw std::bad_alloc();
+                }
+                Slab* slab = ::new (memory) Slab{this, size_class};
+                bump[size_class] = reinterpret_cast<char*>(slab + 1);
+                bump_end[size_class] = static_cast<char*>(memory) + kSlabSize;
+            }
+            void* result = bump[size_class];
+            bump[size_class] += block_size;
+            return result;
+        }
+
+        void Return(size_t size_class, FreeBlock* block) {
+            FreeBlock* head = returned[size_class].load(std::memory_order_relaxed);
+            do {
+                block->next = head;
+            } while (!returned[size_class].compare_exchange_weak(
+                head, block, std::memory_order_release, std::memory_order_relaxed));
+        }
+    };
+
+    // Heaps of exited threads, waiting for a new owner. The fallback heap serves allocations
+    // made during thread exit, after the thread has given its own heap away.
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Heap*> abandoned;
+        Heap fallback;
+
+        // Never destroyed: blocks may still be freed by static destructors.
+        static Registry& Instance() {
+            static Registry& registry = *new Registry();
+            return registry;
+        }
+    };
+
+    struct HeapOwner {
+        bool exited = false;
+
+        ~HeapOwner() {
+            Registry& registry = Registry::Instance();
+            std::lock_guard lock(registry.mutex);
+            registry.abandoned.push_back(current_heap);
+            current_heap = nullptr;
+            exited = true;
+        }
+    };
+
+    static inline thread_local Heap* current_heap = nullptr;
+
+    static size_t SizeClass(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kAlignment;
+    }
+
+    static void* AllocateSlow(size_t size_class) {
+        static thread_local HeapOwner owner;
+        Registry& registry = Registry::Instance();
+        std::lock_guard lock(registry.mutex);
+        if (owner.exited) {
+            // Nobody owns the fallback heap, so its blocks always come back through `Return`.
+            return registry.fallback.Pop(size_class);
+        }
+        if (registry.abandoned.empty()) {
+            current_heap = new Heap();
+        } else {
+            current_heap = registry.abandoned.back();
+            registry.abandoned.pop_back();
+        }
+        return current_heap->Pop(size_class);
+    }
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Opt-in statistics for production builds: compile with `-DSMART_PTRS_STATS`. Without it,
+// `CountStat` is an empty inline function and `GetSmartPtrStats()` returns zeros.
+//
+// Every thread counts into its own shard with plain loads and stores (no read-modify-write and
+// no shared cache line); `GetSmartPtrStats()` sums the shards under a lock and may run on any
+// thread, e.g. from a metrics exporter. Shards of exited threads are handed over to new threads,
+// so their counts are kept. Counts made during thread exit go to a shared fallback shard.
+
+enum class Stat {
+    kControlBlocksAllocated,
+    kControlBlocksFreed,
+    kObjectsDestroyed,  // Objects owned by `SharedPtr`s, when the last one goes away
+    kObjectBlockBytesAllocated,  // `MakeShared` blocks with the object inside
+    kObjectBlockBytesFreed,
+    kLockSucceeded,  // `WeakPtr::Lock` and `IntrusiveWeakPtr::Lock`
+    kLockFailed,
+    kIntrusiveDestroyed,  // `RefCounted` objects, when their count drops to zero
+    kNumStats
+};
+
+// A snapshot. Counts are monotonic; the derived values are exact once no other thread is using
+// smart pointers and approximate while they are.
+struct SmartPtrStats {
+    uint64_t control_blocks_allocated = 0;
+    uint64_t control_blocks_freed = 0;
+    uint64_t objects_destroyed = 0;
+    uint64_t object_block_bytes_allocated = 0;
+    uint64_t object_block_bytes_freed = 0;
+    uint64_t lock_succeeded = 0;
+    uint64_t lock_failed = 0;
+    uint64_t intrusive_destroyed = 0;
+
+    // Objects owned by `SharedPtr`s.
+    uint64_t LiveObjects() const {
+        return control_blocks_allocated - objects_destroyed;
+    }
+
+    // Control blocks whose object is gone but weak references are left.
+    uint64_t WeakOnlyBlocks() const {
+        return objects_destroyed - control_blocks_freed;
+    }
+
+    // Bytes of `MakeShared` blocks, including those kept by weak references only.
+    uint64_t ObjectBlockBytes() const {
+        return object_block_bytes_allocated - object_block_bytes_freed;
+    }
+
+    // Counts between two snapshots, e.g. for rates.
+    SmartPtrStats operator-(const SmartPtrStats& earlier) const {
+        return SmartPtrStats{
+            .control_blocks_allocated = control_blocks_allocated - earlier.control_blocks_allocated,
+            .control_blocks_freed = control_blocks_freed - earlier.control_blocks_freed,
+            .objects_destroyed = objects_destroyed - earlier.objects_destroyed,
+            .object_block_bytes_allocated =
+                object_block_bytes_allocated - earlier.object_block_bytes_allocated,
+            .object_block_bytes_freed = object_block_bytes_freed - earlier.object_block_bytes_freed,
+            .lock_succeeded = lock_succeeded - earlier.lock_succeeded,
+            .lock_failed = lock_failed - earlier.lock_failed,
+            .intrusive_destroyed = intrusive_destroyed - earlier.intrusive_destroyed,
+        };
+    }
+};
+
+#ifdef SMART_PTRS_STATS
+
+inline constexpr bool kSmartPtrStatsEnabled = true;
+
+namespace detail {
+class StatShards {
+public:
+    static void Add(Stat stat, uint64_t count) {
+        Shard* shard = current_shard;
+        if (shard == nullptr) [[unlikely]] {
+            shard = Attach();
+        }
+        if (shard != nullptr) [[likely]] {
+            // Only this thread writes to its shard.
+            auto& value = shard->values[static_cast<size_t>(stat)];
+            value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        } else {
+            Registry::Instance().fallback.values[static_cast<size_t>(stat)].fetch_add(
+                count, std::memory_order_relaxed);
+        }
+    }
+
+    static SmartPtrStats Snapshot() {
+        uint64_t totals[static_cast<size_t>(Stat::kNumStats)] = {};
+        Registry& registry = Registry::Instance();
+        std::lock_guard lock(registry.mutex);
+        auto add = [&totals](const Shard& shard) {
+            for (size_t i = 0; i < static_cast<size_t>(Stat::kNumStats); ++i) {
+                totals[i] += shard.values[i].load(std::memory_order_relaxed);
+            }
+        };
+        for (const Shard* shard : registry.shards) {
+            add(*shard);
+        }
+        add(registry.fallback);
+        auto get = [&totals](Stat stat) { return totals[static_cast<size_t>(stat)]; };
+        return SmartPtrStats{
+            .control_blocks_allocated = get(Stat::kControlBlocksAllocated),
+            .control_blocks_freed = get(Stat::kControlBlocksFreed),
+            .objects_destroyed = get(Stat::kObjectsDestroyed),
+            .object_block_bytes_allocated = get(Stat::kObjectBlockBytesAllocated),
+            .object_block_bytes_freed = get(Stat::kObjectBlockBytesFreed),
+            .lock_succeeded = get(Stat::kLockSucceeded),
+            .lock_failed = get(Stat::kLockFailed),
+            .intrusive_destroyed = get(Stat::kIntrusiveDestroyed),
+        };
+    }
+
+private:
+    struct Shard {
+        std::atomic<uint64_t> values[static_cast<size_t>(Stat::kNumStats)] = {};
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Shard*> shards;
+        std::vector<Shard*> abandoned;
+        Shard fallback;
+
+        // Never destroyed: pointers are released during static destruction too.
+        static Registry& Instance() {
+            static Registry& registry = *new Registry();
+            return registry;
+        }
+    };
+
+    struct ShardOwner {
+        bool exited = false;
+
+        ~ShardOwner() {
+            Registry& registry = Registry::Instance();
+            std::lock_guard lock(registry.mutex);
+            registry.abandoned.push_back(current_shard);
+            current_shard = nullptr;
+            exited = true;
+        }
+    };
+
+    static inline thread_local Shard* current_shard = nullptr;
+
+    // Returns null once the thread has exited.
+    static Shard* Attach() {
+        static thread_local ShardOwner owner;
+        if (owner.exited) {
+            return nullptr;
+        }
+        Registry& registry = Registry::Instance();
+        std::lock_guard lock(registry.mutex);
+        if (registry.abandoned.empty()) {
+            current_shard = new Shard();
+            registry.shards.push_back(current_shard);
+        } else {
+            current_shard = registry.abandoned.back();
+            registry.abandoned.pop_back();
+        }
+        return current_shard;
+    }
+};
+}  // namespace detail
+
+inline void CountStat(Stat stat, uint64_t count = 1) {
+    detail::StatShards::Add(stat, count);
+}
+
+inline SmartPtrStats GetSmartPtrStats() {
+    return detail::StatShards::Snapshot();
+}
+
+#else
+
+inline constexpr bool kSmartPtrStatsEnabled = false;
+
+inline void CountStat(Stat, uint64_t = 1) {
+}
+
+inline SmartPtrStats GetSmartPtrStats() {
+    return {};
+}
+
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <common/hazard_pointers.h>
+
+#include <atomic>
+#include <utility>
+
+// An `IntrusivePtr` slot for lock-free structures whose readers do not touch the count.
+//
+//     HazardPointer hazard;
+//     Node* node = slot.Protect(hazard);  // No counter traffic
+//
+// The slot holds one reference. A writer that replaces the object retires that reference to
+// `HazardDomain`, which drops it once no hazard pointer protects the object; objects that are
+// also owned elsewhere simply live on. Use thread-safe counters (`SimpleAtomicRefCounted`).
+template <typename T>
+class HazardIntrusivePtr {
+public:
+    HazardIntrusivePtr() = default;
+
+    HazardIntrusivePtr(IntrusivePtr<T> desired) {
+        ptr_.store(std::exchange(desired.ptr_, nullptr), std::memory_order_relaxed);
+    }
+
+    HazardIntrusivePtr(const HazardIntrusivePtr&) = delete;
+    HazardIntrusivePtr& operator=(const HazardIntrusivePtr&) = delete;
+
+    // No reader may be left.
+    ~HazardIntrusivePtr() {
+        if (T* object = ptr_.load(std::memory_order_relaxed)) {
+            object->DecRef();
+        }
+    }
+
+    // Valid until `hazard` protects something else.
+    T* Protect(HazardPointer& hazard) const {
+        return hazard.Protect(ptr_);
+    }
+
+    // The protected object still has the reference of the slot or of the retired list, so taking
+    // another one is safe.
+    IntrusivePtr<T> Load() const {
+        HazardPointer hazard;
+        return IntrusivePtr<T>(hazard.Protect(ptr_));
+    }
+
+    void Store(IntrusivePtr<T> desired) {
+        Retire(ptr_.exchange(std::exchange(desired.ptr_, nullptr), std::memory_order_acq_rel));
+    }
+
+    IntrusivePtr<T> Exchange(IntrusivePtr<T> desired) {
+        T* previous =
+            ptr_.exchange(std::exchange(desired.ptr_, nullptr), std::memory_order_acq_rel);
+        IntrusivePtr<T> result(previous);
+        Retire(previous);
+        return result;
+    }
+
+private:
+    std::atomic<T*> ptr_ = nullptr;
+
+    static void Retire(T* object) {
+        if (object == nullptr) {
+            return;
+        }
+        HazardDomain::Retire(object, [](void* ptr) { static_cast<T*>(ptr)->DecRef(); });
+    }
+};
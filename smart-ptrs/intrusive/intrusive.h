@@ -1,16 +1,22 @@
 #pragma once
 
+#include <common/destruction_worklist.h>
+#include <common/stats.h>
+
+#include <atomic>
 #include <cstddef>  // for std::nullptr_t
+#include <span>
+#include <type_traits>
 #include <utility>  // for std::exchange / std::swap
 
 class SimpleCounter {
 public:
-    size_t IncRef() {
-        ++count_;
+    size_t IncRef(size_t count = 1) {
+        count_ += count;
         return count_;
     }
-    size_t DecRef() {
-        --count_;
+    size_t DecRef(size_t count = 1) {
+        count_ -= count;
         return count_;
     }
     size_t RefCount() const {
@@ -21,6 +27,43 @@ private:
     size_t count_ = 0;
 };
 
+// Counter for objects shared between threads. Increments are relaxed: whoever increments already
+// holds a reference. Decrements release, and the one that reaches zero adds an acquire fence, so
+// all writes made through other references happen before the object is destroyed.
+class ThreadSafeCounter {
+public:
+    size_t IncRef(size_t count = 1) {
+        return count_.fetch_add(count, std::memory_order_relaxed) + count;
+    }
+    size_t DecRef(size_t count = 1) {
+        count = count_.fetch_sub(count, std::memory_order_release) - count;
+        if (count == 0) {
+#if defined(__SANITIZE_THREAD__)
+            // ThreadSanitizer does not model fences; an acquire load of the counter is equivalent.
+            count_.load(std::memory_order_acquire);
+#else
+            std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+        }
+        return count;
+    }
+    bool TryIncRef() {
+        size_t count = count_.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (count_.compare_exchange_weak(count, count + 1, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<size_t> count_ = 0;
+};
+
 struct DefaultDelete {
     template <typename T>
     static void Destroy(T* object) {
@@ -31,18 +74,56 @@ struct DefaultDelete {
 template <typename Derived, typename Counter, typename Deleter>
 class RefCounted {
 public:
-    // Increase reference counter.
-    void IncRef() {
-        counter_.IncRef();
+    RefCounted() = default;
+
+    // The count belongs to the object, not to its value: a copy starts without references, and
+    // assignment keeps the references to the target.
+    RefCounted(const RefCounted&) {
+    }
+    RefCounted& operator=(const RefCounted&) {
+        return *this;
+    }
+
+    // Increase reference counter. Returns the new count.
+    size_t IncRef() {
+        return counter_.IncRef();
     }
 
     // Decrease reference counter.
-    // Destroy object using Deleter when the last instance dies.
+    // Destroy object using Deleter when the last instance dies (through `DestructionWorklist`, so
+    // long chains are destroyed in constant stack). The decision comes from the value the
+    // decrement returns: one read-modify-write per release, and exactly one release sees zero.
     void DecRef() {
-        if (counter_.RefCount() == 0 || counter_.RefCount() == 1) {
-            Deleter::Destroy(static_cast<Derived*>(this));
+        if (counter_.DecRef() != 0) [[likely]] {
+            return;
+        }
+        Destroy();
+    }
+
+    // Take or drop `count` references with a single counter update, e.g. to hand one object to
+    // many owners at once (see `CloneN`). `Retain` returns the new count.
+    size_t Retain(size_t count) {
+        return counter_.IncRef(count);
+    }
+
+    void ReleaseN(size_t count) {
+        if (counter_.DecRef(count) != 0) [[likely]] {
+            return;
+        }
+        Destroy();
+    }
+
+    // Increase reference counter unless it is zero: the object is gone or on its way out. Used by
+    // `IntrusiveWeakPtr::Lock`; counters shared between threads provide `TryIncRef` for this.
+    bool TryIncRef() {
+        if constexpr (requires { counter_.TryIncRef(); }) {
+            return counter_.TryIncRef();
         } else {
-            counter_.DecRef();
+            if (counter_.RefCount() == 0) {
+                return false;
+            }
+            counter_.IncRef();
+            return true;
         }
     }
 
@@ -53,16 +134,42 @@ public:
 
 private:
     Counter counter_;
+
+    void Destroy() {
+        CountStat(Stat::kIntrusiveDestroyed);
+        DestructionWorklist::Run(static_cast<Derived*>(this), [](void* object) {
+            Deleter::Destroy(static_cast<Derived*>(object));
+        });
+    }
 };
 
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+template <typename Derived, typename D = DefaultDelete>
+using SimpleAtomicRefCounted = RefCounted<Derived, ThreadSafeCounter, D>;
+
+template <typename T>
+class IntrusiveWeakPtr;
+
+template <typename T>
+class HazardIntrusivePtr;
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
     friend class IntrusivePtr;
 
+    template <typename Y>
+    friend class IntrusiveWeakPtr;
+
+    template <typename Y>
+    friend class HazardIntrusivePtr;
+
+    template <typename Y>
+    friend void CloneN(const IntrusivePtr<Y>& ptr,
+                       std::type_identity_t<std::span<IntrusivePtr<Y>>> out);
+
 public:
     // Constructors
     IntrusivePtr() {
@@ -130,8 +237,7 @@ public:
     }
 
     void Reset(T* ptr) {
-        DecreaseCounter();
-        ptr_ = ptr;
+        IntrusivePtr(ptr).Swap(*this);
     }
 
     void Swap(IntrusivePtr& other) {
@@ -184,3 +290,17 @@ template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
 }
+
+// Fills `out` (a vector, an array, a span) with copies of `ptr` using one counter update instead
+// of one per copy. Pointers already in `out` are released.
+template <typename T>
+void CloneN(const IntrusivePtr<T>& ptr, std::type_identity_t<std::span<IntrusivePtr<T>>> out) {
+    T* object = ptr.ptr_;
+    if (object != nullptr) {
+        object->Retain(out.size());
+    }
+    for (IntrusivePtr<T>& copy : out) {
+        copy.DecreaseCounter();
+        copy.ptr_ = object;
+    }
+}
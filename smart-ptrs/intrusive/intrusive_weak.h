@@ -0,0 +1,231 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <atomic>
+#include <cstddef>  // for std::nullptr_t
+#include <mutex>
+#include <utility>  // for std::exchange / std::swap
+
+// Weak references to `RefCounted` objects.
+//
+// An object opts in by deriving from `WeakRefCounted` instead of `RefCounted`. This costs one
+// pointer in the object. The weak count and the "still alive" flag live in a side table, which
+// the first `IntrusiveWeakPtr` to the object allocates, so objects that are never observed weakly
+// never allocate it. The table outlives the object for as long as weak pointers to it remain.
+//
+//     struct Node : WeakRefCounted<Node, SimpleCounter> {
+//         IntrusiveWeakPtr<Node> parent;
+//     };
+
+namespace detail {
+class IntrusiveWeakTable {
+public:
+    // `Lock` and the destruction of the object serialize on this: once `alive` is cleared, no
+    // lock can reach the object any more.
+    std::mutex mutex;
+    bool alive = true;
+
+    void Acquire() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+private:
+    // Weak pointers, plus one held by the object while it is alive.
+    std::atomic<size_t> refs_ = 1;
+};
+}  // namespace detail
+
+// Marks the object as dead in its side table before `Deleter` destroys it.
+template <typename Deleter>
+struct WeakTableDeleter {
+    template <typename T>
+    static void Destroy(T* object) {
+        object->DetachWeakTable();
+        Deleter::Destroy(object);
+    }
+};
+
+template <typename Derived, typename Counter, typename Deleter = DefaultDelete>
+class WeakRefCounted : public RefCounted<Derived, Counter, WeakTableDeleter<Deleter>> {
+    using Base = RefCounted<Derived, Counter, WeakTableDeleter<Deleter>>;
+
+    template <typename T>
+    friend class IntrusiveWeakPtr;
+
+    friend WeakTableDeleter<Deleter>;
+
+public:
+    WeakRefCounted() = default;
+
+    // A copy is a new object: no references to it yet, strong or weak.
+    WeakRefCounted(const WeakRefCounted&) : Base() {
+    }
+
+    WeakRefCounted& operator=(const WeakRefCounted&) {
+        return *this;
+    }
+
+private:
+    mutable std::atomic<detail::IntrusiveWeakTable*> weak_table_ = nullptr;
+
+    // Returns the side table with one reference for the caller, creating it on first use.
+    detail::IntrusiveWeakTable* AcquireWeakTable() const {
+        detail::IntrusiveWeakTable* table = weak_table_.load(std::memory_order_acquire);
+        if (table == nullptr) {
+            auto* created = new detail::IntrusiveWeakTable();
+            if (weak_table_.compare_exchange_strong(table, created, std::memory_order_acq_rel,
+                                                    std::memory_order_acquire)) {
+                table = created;
+            } else {
+                delete created;
+            }
+        }
+        table->Acquire();
+        return table;
+    }
+
+    void DetachWeakTable() {
+        detail::IntrusiveWeakTable* table = weak_table_.load(std::memory_order_acquire);
+        if (table == nullptr) {
+            return;
+        }
+        {
+            std::lock_guard lock(table->mutex);
+            table->alive = false;
+        }
+        table->Release();
+    }
+};
+
+template <typename T>
+class IntrusiveWeakPtr {
+    template <typename Y>
+    friend class IntrusiveWeakPtr;
+
+public:
+    // Constructors
+    IntrusiveWeakPtr() {
+        ptr_ = nullptr;
+        table_ = nullptr;
+    }
+
+    IntrusiveWeakPtr(std::nullptr_t) {
+        ptr_ = nullptr;
+        table_ = nullptr;
+    }
+
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusivePtr<Y>& other) {
+        ptr_ = other.ptr_;
+        table_ = ptr_ == nullptr ? nullptr : ptr_->AcquireWeakTable();
+    }
+
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) {
+        ptr_ = other.ptr_;
+        table_ = other.table_;
+        IncreaseCounter();
+    }
+
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusiveWeakPtr<Y>& other) {
+        ptr_ = other.ptr_;
+        table_ = other.table_;
+        IncreaseCounter();
+    }
+
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other) {
+        ptr_ = std::exchange(other.ptr_, nullptr);
+        table_ = std::exchange(other.table_, nullptr);
+    }
+
+    // `operator=`-s
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        if (this == &other) {
+            return *this;
+        }
+        DecreaseCounter();
+        ptr_ = other.ptr_;
+        table_ = other.table_;
+        IncreaseCounter();
+        return *this;
+    }
+
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) {
+        if (this == &other) {
+            return *this;
+        }
+        DecreaseCounter();
+        ptr_ = std::exchange(other.ptr_, nullptr);
+        table_ = std::exchange(other.table_, nullptr);
+        return *this;
+    }
+
+    // Destructor
+    ~IntrusiveWeakPtr() {
+        DecreaseCounter();
+    }
+
+    // Modifiers
+    void Reset() {
+        DecreaseCounter();
+    }
+
+    void Swap(IntrusiveWeakPtr& other) {
+        std::swap(ptr_, other.ptr_);
+        std::swap(table_, other.table_);
+    }
+
+    // Observers
+    bool Expired() const {
+        if (table_ == nullptr) {
+            return true;
+        }
+        std::lock_guard lock(table_->mutex);
+        return !table_->alive || ptr_->RefCount() == 0;
+    }
+
+    // Safe to race with the last `IntrusivePtr` going away on another thread if the counter
+    // provides `TryIncRef`.
+    IntrusivePtr<T> Lock() const {
+        IntrusivePtr<T> locked;
+        if (table_ == nullptr) {
+            CountStat(Stat::kLockFailed);
+            return locked;
+        }
+        std::lock_guard lock(table_->mutex);
+        if (table_->alive && ptr_->TryIncRef()) {
+            locked.ptr_ = ptr_;
+            CountStat(Stat::kLockSucceeded);
+        } else {
+            CountStat(Stat::kLockFailed);
+        }
+        return locked;
+    }
+
+private:
+    T* ptr_;
+    detail::IntrusiveWeakTable* table_;
+
+    void IncreaseCounter() {
+        if (table_ == nullptr) {
+            return;
+        }
+        table_->Acquire();
+    }
+
+    void DecreaseCounter() {
+        if (table_ == nullptr) {
+            return;
+        }
+        table_->Release();
+        table_ = nullptr;
+        ptr_ = nullptr;
+    }
+};
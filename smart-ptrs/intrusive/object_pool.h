@@ -0,0 +1,280 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Recycles the storage of reference-counted objects.
+//
+//     struct Message : ObjectInPool<Message> { ... };
+//     ObjectPool<Message> pool;
+//     IntrusivePtr<Message> message = pool.Allocate(args...);
+//
+// When the last `IntrusivePtr` goes away, the object is destroyed and its storage goes back to the
+// pool; `Allocate` constructs the next object right into recycled storage. Every thread has its
+// own cache of free storage. Storage released by the thread that allocated it goes straight back
+// to that thread's cache; storage released by any other thread is pushed onto the owner's
+// lock-free return stack, which the owner takes over once its cache runs dry. In steady state
+// neither path allocates or takes a lock.
+//
+// An exited thread's cache is handed over to the next thread that uses the pool. The pool must
+// outlive its objects.
+
+struct ObjectPoolOptions {
+    // Free objects a thread keeps. Once its cache holds more than `max_cached`, the storage of all
+    // but `trim_to` of them is freed.
+    size_t max_cached = 1024;
+    size_t trim_to = 512;
+};
+
+template <typename T>
+class ObjectPool;
+
+struct ReturnToPool {
+    template <typename T>
+    static void Destroy(T* object) {
+        ObjectPool<T>::Release(object);
+    }
+};
+
+// Base for objects allocated from an `ObjectPool<Derived>`.
+template <typename Derived, typename Counter = ThreadSafeCounter>
+using ObjectInPool = RefCounted<Derived, Counter, ReturnToPool>;
+
+template <typename T>
+class ObjectPool {
+public:
+    explicit ObjectPool(ObjectPoolOptions options = {}) {
+        options_ = options;
+        id_ = next_id.fetch_add(1, std::memory_order_relaxed);
+        Registry& registry = Registry::Instance();
+        std::lock_guard lock(registry.mutex);
+        registry.pools.push_back(this);
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    ~ObjectPool() {
+        assert(NumInUse() == 0 && "pool destroyed before its objects");
+        {
+            Registry& registry = Registry::Instance();
+            std::lock_guard lock(registry.mutex);
+            std::erase(registry.pools, this);
+        }
+        for (Cache* cache : caches_) {
+            cache->Trim(0);
+            delete cache;
+        }
+        orphans_.Trim(0);
+        if (current.pool_id == id_) {
+            current = CurrentCache();
+        }
+    }
+
+    template <typename... Args>
+    IntrusivePtr<T> Allocate(Args&&... args) {
+        Cache* cache = current.pool_id == id_ ? current.cache : AttachCache();
+        Slot* slot;
+        if (cache != nullptr) [[likely]] {
+            slot = cache->Pop();
+        } else {
+            // Threads past their exit hook share `orphans_` under the lock.
+            std::lock_guard lock(mutex_);
+            slot = orphans_.Pop();
+            cache = &orphans_;
+        }
+        if (slot == nullptr) {
+            slot = new Slot;
+            slot->home = cache;
+            allocated_.fetch_add(1, std::memory_order_relaxed);
+        }
+        T* object;
+        try {
+            object = ::new (static_cast<void*>(slot->storage)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            Release(slot);
+            throw;
+        }
+        in_use_.fetch_add(1, std::memory_order_relaxed);
+        return IntrusivePtr<T>(object);
+    }
+
+    // Frees the storage cached by the calling thread.
+    void Trim() {
+        if (current.pool_id == id_) {
+            current.cache->Trim(0);
+        }
+    }
+
+    // Both are approximate while other threads use the pool.
+    size_t NumAvailable() const {
+        return allocated_.load(std::memory_order_relaxed) - NumInUse();
+    }
+
+    size_t NumInUse() const {
+        return in_use_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Cache;
+
+    // The object comes first, so the object and its slot share an address.
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+        Slot* next;
+        Cache* home;
+    };
+
+    struct Cache {
+        ObjectPool* pool;
+        std::thread::id owner;  // Guarded by `pool->mutex_`; empty once the thread has exited
+        Slot* free = nullptr;
+        size_t size = 0;
+        std::atomic<Slot*> returned = nullptr;
+
+        Slot* Pop() {
+            if (free == nullptr) {
+                free = returned.exchange(nullptr, std::memory_order_acquire);
+                for (Slot* slot = free; slot != nullptr; slot = slot->next) {
+                    ++size;
+                }
+            }
+            Slot* slot = free;
+            if (slot != nullptr) {
+                free = slot->next;
+                --size;
+            }
+            return slot;
+        }
+
+        void Push(Slot* slot) {
+            slot->next = free;
+            free = slot;
+            if (++size > pool->options_.max_cached) {
+                Trim(pool->options_.trim_to);
+            }
+        }
+
+        void Return(Slot* slot) {
+            Slot* head = returned.load(std::memory_order_relaxed);
+            do {
+                slot->next = head;
+            } while (!returned.compare_exchange_weak(head, slot, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+        }
+
+        // Frees cached storage until `keep` slots are left, returned ones included.
+        void Trim(size_t keep) {
+            while (size > keep || (keep == 0 && returned.load(std::memory_order_relaxed))) {
+                delete Pop();
+                pool->allocated_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    struct CurrentCache {
+        uint64_t pool_id = 0;
+        Cache* cache = nullptr;
+    };
+
+    // Pools of this type, for the thread exit hook.
+    struct Registry {
+        std::mutex mutex;
+        std::vector<ObjectPool*> pools;
+
+        // Never destroyed: threads may exit during static destruction.
+        static Registry& Instance() {
+            static Registry& registry = *new Registry();
+            return registry;
+        }
+    };
+
+    struct ThreadExit {
+        bool exited = false;
+
+        ~ThreadExit() {
+            Registry& registry = Registry::Instance();
+            std::lock_guard lock(registry.mutex);
+            for (ObjectPool* pool : registry.pools) {
+                std::lock_guard pool_lock(pool->mutex_);
+                for (Cache* cache : pool->caches_) {
+                    if (cache->owner == std::this_thread::get_id()) {
+                        cache->owner = std::thread::id();
+                    }
+                }
+            }
+            current = CurrentCache();
+            exited = true;
+        }
+    };
+
+    static inline std::atomic<uint64_t> next_id = 1;
+
+    // One entry per thread and type: a thread alternating between pools of the same type takes
+    // the lock on every switch.
+    static inline thread_local CurrentCache current;
+
+    ObjectPoolOptions options_;
+    uint64_t id_;
+    std::atomic<size_t> allocated_ = 0;
+    std::atomic<size_t> in_use_ = 0;
+    std::mutex mutex_;
+    std::vector<Cache*> caches_;
+    Cache orphans_{this};
+
+    static void Release(T* object) {
+        auto* slot = reinterpret_cast<Slot*>(object);
+        std::destroy_at(object);
+        slot->home->pool->in_use_.fetch_sub(1, std::memory_order_relaxed);
+        Release(slot);
+    }
+
+    static void Release(Slot* slot) {
+        Cache* home = slot->home;
+        if (current.cache == home && current.pool_id == home->pool->id_) [[likely]] {
+            home->Push(slot);
+        } else {
+            home->Return(slot);
+        }
+    }
+
+    // Finds the calling thread's cache: its own, an exited thread's, or a new one. Returns null
+    // once the thread has exited.
+    Cache* AttachCache() {
+        static thread_local ThreadExit thread_exit;
+        if (thread_exit.exited) {
+            return nullptr;
+        }
+        std::lock_guard lock(mutex_);
+        std::thread::id self = std::this_thread::get_id();
+        Cache* attached = nullptr;
+        for (Cache* cache : caches_) {
+            if (cache->owner == self) {
+                attached = cache;
+                break;
+            }
+            if (cache->owner == std::thread::id() && attached == nullptr) {
+                attached = cache;
+            }
+        }
+        if (attached == nullptr) {
+            attached = new Cache{this};
+            caches_.push_back(attached);
+        }
+        attached->owner = self;
+        current = CurrentCache{id_, attached};
+        return attached;
+    }
+
+    friend ReturnToPool;
+};
@@ -1,10 +1,17 @@
 #include "intrusive.h"
+#include "intrusive_weak.h"
+#include "object_pool.h"
+#include "hazard_intrusive.h"
 
 #include <catch.hpp>
 
 #include "allocations_checker.h"
 
+#include <atomic>
+#include <span>
 #include <string>
+#include <thread>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -248,6 +255,10 @@ TEST_CASE("From raw pointer") {
     IntrusivePtr<MyString> c{a};
     IntrusivePtr<MyString> d{c.Get()};
     REQUIRE(str->RefCount() == 4);
+    REQUIRE(str->IncRef() == 5);
+    str->DecRef();
+    d.Reset(str);
+    REQUIRE(str->RefCount() == 4);
 }
 
 struct Pinned : SimpleRefCounted<Pinned> {
@@ -274,101 +285,31 @@ TEST_CASE("No copies") {
     IntrusivePtr<Pinned> p(new Pinned(1));
 }
 
-template <typename T>
-class ObjectInPool;
-
-template <typename T>
-class ObjectPool {
-    static_assert(std::is_base_of_v<ObjectInPool<T>, T>, "Unsupported type");
-
-public:
-    template <typename... Args>
-    IntrusivePtr<T> Allocate(Args&&... args) {
-        if (!objects_.empty()) {
-            std::unique_ptr<T> ptr = std::move(objects_.back());
-            objects_.pop_back();
-            return IntrusivePtr<T>(ptr.release());
-        }
-        return DoAllocate(std::forward<Args>(args)...);
-    }
-
-    void Release(T* ptr) {
-        objects_.emplace_back(ptr);
-    }
-
-    size_t NumAvailable() const {
-        return objects_.size();
-    }
-
-    size_t NumInUse() const {
-        return allocated_ - NumAvailable();
-    }
-
-private:
-    template <typename... Args>
-    IntrusivePtr<T> DoAllocate(Args&&... args) {
-        ++allocated_;
-        std::unique_ptr<T> object = std::make_unique<T>(std::forward<Args>(args)...);
-        object->SetHome(this);
-        return IntrusivePtr<T>(object.release());
-    }
-
-private:
-    std::vector<std::unique_ptr<T>> objects_;
-    size_t allocated_ = 0;
-};
-
-template <typename Derived>
-class ObjectInPool {
-public:
-    void IncRef() {
-        count_++;
-    }
-
-    void DecRef() {
-        if (--count_ == 0) {
-            TakeMeHome();
-        }
-    }
-
-    size_t RefCount() const {
-        return count_;
-    }
-
-    void SetHome(ObjectPool<Derived>* pool) {
-        home_ = pool;
-    }
-
-private:
-    void TakeMeHome() {
-        home_->Release(static_cast<Derived*>(this));
-    }
-
-private:
-    size_t count_ = 0;
-    ObjectPool<Derived>* home_;
-};
-
 struct PoolableString : ObjectInPool<PoolableString>, std::string {
     using std::string::basic_string;
 };
 
+struct PoolableCounted : ObjectInPool<PoolableCounted, SimpleCounter>,
+                         ObjectCounters<PoolableCounted> {};
+
 TEST_CASE("Object pool") {
     ObjectPool<PoolableString> strs;
 
     SECTION("Simple") {
         strs.Allocate("first");
-        REQUIRE(*strs.Allocate("second") == "first");
-        REQUIRE(*strs.Allocate("third") == "first");
+        REQUIRE(*strs.Allocate("second") == "second");
+        REQUIRE(*strs.Allocate("third") == "third");
         REQUIRE(strs.NumAvailable() == 1);
         REQUIRE(strs.NumInUse() == 0);
     }
 
     SECTION("Reuse") {
+        const PoolableString* first;
         {
             auto a = strs.Allocate("first");
             auto b = strs.Allocate("second");
             auto c = strs.Allocate("third");
+            first = a.Get();
             REQUIRE(strs.NumAvailable() == 0);
             REQUIRE(strs.NumInUse() == 3);
         }
@@ -379,9 +320,9 @@ TEST_CASE("Object pool") {
             auto a = strs.Allocate("aa");
             auto b = strs.Allocate("bb");
             auto c = strs.Allocate("cc");
-            REQUIRE(*a == "first");
-            REQUIRE(*b == "second");
-            REQUIRE(*c == "third");
+            REQUIRE(*a == "aa");
+            REQUIRE(*c == "cc");
+            REQUIRE(a.Get() == first);
         }
 
         {
@@ -396,4 +337,410 @@ TEST_CASE("Object pool") {
         REQUIRE(strs.NumAvailable() == 3);
         REQUIRE(strs.NumInUse() == 1);
     }
+
+    SECTION("Destroyed on release") {
+        PoolableCounted::ResetCounters();
+        ObjectPool<PoolableCounted> pool;
+        auto a = pool.Allocate();
+        a.Reset();
+        REQUIRE(PoolableCounted::NumAlive() == 0);
+        auto b = pool.Allocate();
+        REQUIRE(PoolableCounted::NumCreated() == 2);
+    }
+
+    SECTION("Trim") {
+        ObjectPool<PoolableString> pool({.max_cached = 4, .trim_to = 2});
+        {
+            std::vector<IntrusivePtr<PoolableString>> batch;
+            for (int i = 0; i < 6; ++i) {
+                batch.push_back(pool.Allocate("x"));
+            }
+            batch.clear();
+        }
+        REQUIRE(pool.NumAvailable() == 3);
+        pool.Trim();
+        REQUIRE(pool.NumAvailable() == 0);
+    }
+
+    SECTION("Released on another thread") {
+        std::vector<IntrusivePtr<PoolableString>> batch;
+        for (int i = 0; i < 8; ++i) {
+            batch.push_back(strs.Allocate("x"));
+        }
+        std::thread([&batch] { batch.clear(); }).join();
+        REQUIRE(strs.NumInUse() == 0);
+        EXPECT_ZERO_ALLOCATIONS(for (int i = 0; i < 8; ++i) {
+            batch.push_back(strs.Allocate("y"));
+        });
+        batch.clear();
+    }
+
+    SECTION("Many threads") {
+        constexpr int kNumThreads = 4;
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> threads;
+        std::vector<std::vector<IntrusivePtr<PoolableString>>> handoff(kNumThreads);
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([&, i] {
+                std::string tag = std::to_string(i);
+                for (int round = 0; round < 1000; ++round) {
+                    std::vector<IntrusivePtr<PoolableString>> batch;
+                    for (int j = 0; j < 16; ++j) {
+                        batch.push_back(strs.Allocate(tag.c_str()));
+                    }
+                    for (auto& str : batch) {
+                        if (*str != tag) {
+                            ++mismatches;
+                        }
+                    }
+                    handoff[i] = std::move(batch);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        handoff.clear();
+        REQUIRE(mismatches == 0);
+        REQUIRE(strs.NumInUse() == 0);
+    }
+}
+
+struct ChainNode : SimpleRefCounted<ChainNode> {
+    IntrusivePtr<ChainNode> next;
+};
+
+TEST_CASE("Long chains") {
+    IntrusivePtr<ChainNode> head;
+    for (int i = 0; i < 1'000'000; ++i) {
+        IntrusivePtr<ChainNode> node(new ChainNode);
+        node->next = std::move(head);
+        head = std::move(node);
+    }
+    head.Reset();
+    REQUIRE(head.Get() == nullptr);
+}
+
+struct TreeNode : WeakRefCounted<TreeNode, SimpleCounter>, ObjectCounters<TreeNode> {
+    explicit TreeNode(int value) : value(value) {
+    }
+
+    int value;
+    IntrusiveWeakPtr<TreeNode> parent;
+    IntrusivePtr<TreeNode> child;
+};
+
+TEST_CASE("Weak pointers") {
+    TreeNode::ResetCounters();
+
+    SECTION("Lock and expire") {
+        IntrusivePtr<TreeNode> node(new TreeNode(1));
+        IntrusiveWeakPtr<TreeNode> weak(node);
+        REQUIRE(!weak.Expired());
+        REQUIRE(weak.Lock()->value == 1);
+        REQUIRE(node.UseCount() == 1);
+
+        node.Reset();
+        REQUIRE(TreeNode::NumAlive() == 0);
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.Lock().Get() == nullptr);
+    }
+
+    SECTION("Side table only on demand") {
+        EXPECT_ONE_ALLOCATION(IntrusivePtr<TreeNode> node(new TreeNode(1)));
+        IntrusivePtr<TreeNode> node(new TreeNode(2));
+        EXPECT_ONE_ALLOCATION(IntrusiveWeakPtr<TreeNode> weak(node));
+        IntrusiveWeakPtr<TreeNode> weak(node);
+        EXPECT_ZERO_ALLOCATIONS(IntrusiveWeakPtr<TreeNode> other(node); auto copy = weak;);
+    }
+
+    SECTION("Copies and moves") {
+        IntrusivePtr<TreeNode> node(new TreeNode(3));
+        IntrusiveWeakPtr<TreeNode> a(node);
+        IntrusiveWeakPtr<TreeNode> b = a;
+        IntrusiveWeakPtr<TreeNode> c = std::move(a);
+        REQUIRE(a.Expired());
+        b = c;
+        c = std::move(b);
+        b.Swap(c);
+        REQUIRE(b.Lock().Get() == node.Get());
+        c.Reset();
+        REQUIRE(c.Expired());
+        node.Reset();
+        REQUIRE(b.Expired());
+    }
+
+    SECTION("Back pointers") {
+        IntrusivePtr<TreeNode> root(new TreeNode(4));
+        root->child = IntrusivePtr<TreeNode>(new TreeNode(5));
+        root->child->parent = root;
+        REQUIRE(root->child->parent.Lock()->value == 4);
+
+        IntrusivePtr<TreeNode> leaf = root->child;
+        root.Reset();
+        REQUIRE(TreeNode::NumAlive() == 1);
+        REQUIRE(leaf->parent.Expired());
+    }
+
+    SECTION("Copied objects are not observed") {
+        IntrusivePtr<TreeNode> node(new TreeNode(6));
+        IntrusiveWeakPtr<TreeNode> weak(node);
+        IntrusivePtr<TreeNode> copy(new TreeNode(*node));
+        node.Reset();
+        REQUIRE(weak.Expired());
+        REQUIRE(copy->value == 6);
+    }
+}
+
+struct SharedMessage : SimpleAtomicRefCounted<SharedMessage>, ObjectCounters<SharedMessage> {
+    explicit SharedMessage(int id) : id(id) {
+    }
+
+    int id;
+};
+
+struct ObservedMessage : WeakRefCounted<ObservedMessage, ThreadSafeCounter> {
+    int id = 7;
+};
+
+TEST_CASE("Thread-safe counter") {
+    SharedMessage::ResetCounters();
+    constexpr int kNumThreads = 4;
+    constexpr int kNumIters = 100'000;
+
+    SECTION("Copies on many threads") {
+        IntrusivePtr<SharedMessage> message(new SharedMessage(42));
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([message, &mismatches] {
+                for (int j = 0; j < kNumIters; ++j) {
+                    IntrusivePtr<SharedMessage> copy = message;
+                    if (copy->id != 42) {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(mismatches == 0);
+        REQUIRE(message.UseCount() == 1);
+        message.Reset();
+        REQUIRE(SharedMessage::NumAlive() == 0);
+    }
+
+    SECTION("Last release on any thread") {
+        for (int i = 0; i < 100; ++i) {
+            IntrusivePtr<SharedMessage> message(new SharedMessage(i));
+            std::vector<std::thread> threads;
+            for (int j = 0; j < kNumThreads; ++j) {
+                threads.emplace_back([copy = message]() mutable { copy.Reset(); });
+            }
+            message.Reset();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            REQUIRE(SharedMessage::NumAlive() == 0);
+        }
+    }
+
+    SECTION("Lock races with the last release") {
+        for (int i = 0; i < 100; ++i) {
+            IntrusivePtr<ObservedMessage> message(new ObservedMessage());
+            IntrusiveWeakPtr<ObservedMessage> weak(message);
+            bool saw_value = true;
+            std::thread locker([weak, &saw_value] {
+                while (auto locked = weak.Lock()) {
+                    saw_value = saw_value && locked->id == 7;
+                }
+            });
+            message.Reset();
+            locker.join();
+            REQUIRE(saw_value);
+            REQUIRE(weak.Expired());
+        }
+    }
+
+    SECTION("Copied objects") {
+        IntrusivePtr<SharedMessage> message(new SharedMessage(1));
+        IntrusivePtr<SharedMessage> copy(new SharedMessage(*message));
+        REQUIRE(copy.UseCount() == 1);
+        REQUIRE(message.UseCount() == 1);
+    }
+
+    SECTION("Weak pointers on many threads") {
+        IntrusivePtr<ObservedMessage> message(new ObservedMessage());
+        IntrusiveWeakPtr<ObservedMessage> weak(message);
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([weak, &mismatches] {
+                for (int j = 0; j < kNumIters / 10; ++j) {
+                    auto locked = weak.Lock();
+                    IntrusiveWeakPtr<ObservedMessage> copy(locked);
+                    if (locked->id != 7 || copy.Expired()) {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(mismatches == 0);
+        message.Reset();
+        REQUIRE(weak.Expired());
+    }
+}
+
+TEST_CASE("Bulk retain and release") {
+    SECTION("Retain and ReleaseN") {
+        CountedString::ResetCounters();
+        IntrusivePtr<CountedString> str(new CountedString("bulk"));
+        REQUIRE(str->Retain(3) == 4);
+        str->ReleaseN(2);
+        REQUIRE(str.UseCount() == 2);
+        str->ReleaseN(1);
+        REQUIRE(str.UseCount() == 1);
+        CountedString* raw = str.Get();
+        raw->Retain(2);
+        str.Reset();
+        REQUIRE(CountedString::NumAlive() == 1);
+        raw->ReleaseN(2);
+        REQUIRE(CountedString::NumAlive() == 0);
+    }
+
+    SECTION("CloneN") {
+        SharedMessage::ResetCounters();
+        IntrusivePtr<SharedMessage> message(new SharedMessage(5));
+        IntrusivePtr<SharedMessage> other(new SharedMessage(6));
+        std::vector<IntrusivePtr<SharedMessage>> copies(8, other);
+        other.Reset();
+        CloneN(message, copies);
+        REQUIRE(message.UseCount() == 9);
+        REQUIRE(SharedMessage::NumAlive() == 1);
+        for (const auto& copy : copies) {
+            REQUIRE(copy->id == 5);
+        }
+
+        CloneN(copies[0], std::span(copies).first(4));
+        REQUIRE(message.UseCount() == 9);
+        CloneN(IntrusivePtr<SharedMessage>(), copies);
+        REQUIRE(message.UseCount() == 1);
+        EXPECT_ZERO_ALLOCATIONS(CloneN(message, copies));
+        message.Reset();
+        copies.clear();
+        REQUIRE(SharedMessage::NumAlive() == 0);
+    }
+
+    SECTION("Release on many threads") {
+        SharedMessage::ResetCounters();
+        constexpr int kNumThreads = 4;
+        constexpr int kCopiesPerThread = 1000;
+        IntrusivePtr<SharedMessage> message(new SharedMessage(9));
+        std::vector<IntrusivePtr<SharedMessage>> copies(kNumThreads * kCopiesPerThread);
+        CloneN(message, copies);
+        message.Reset();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([&copies, i] {
+                for (int j = 0; j < kCopiesPerThread; ++j) {
+                    copies[i * kCopiesPerThread + j].Reset();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(SharedMessage::NumAlive() == 0);
+    }
+}
+
+TEST_CASE("Hazard pointers") {
+    SharedMessage::ResetCounters();
+    HazardDomain::Scan();
+
+    SECTION("Protected objects are kept") {
+        HazardIntrusivePtr<SharedMessage> slot(IntrusivePtr<SharedMessage>(new SharedMessage(1)));
+        HazardPointer hazard;
+        SharedMessage* first = slot.Protect(hazard);
+        REQUIRE(first->id == 1);
+        REQUIRE(first->RefCount() == 1);
+
+        slot.Store(IntrusivePtr<SharedMessage>(new SharedMessage(2)));
+        REQUIRE(HazardDomain::Scan() == 1);
+        REQUIRE(SharedMessage::NumAlive() == 2);
+        REQUIRE(first->id == 1);
+
+        hazard.Reset();
+        REQUIRE(HazardDomain::Scan() == 0);
+        REQUIRE(SharedMessage::NumAlive() == 1);
+        REQUIRE(slot.Load()->id == 2);
+    }
+
+    SECTION("Owned elsewhere") {
+        IntrusivePtr<SharedMessage> message(new SharedMessage(3));
+        HazardIntrusivePtr<SharedMessage> slot(message);
+        REQUIRE(message.UseCount() == 2);
+        auto previous = slot.Exchange(nullptr);
+        REQUIRE(previous.Get() == message.Get());
+        REQUIRE(slot.Load().Get() == nullptr);
+        HazardDomain::Scan();
+        REQUIRE(message.UseCount() == 2);
+        previous.Reset();
+        message.Reset();
+        REQUIRE(SharedMessage::NumAlive() == 0);
+    }
+
+    SECTION("Retirements are batched") {
+        HazardIntrusivePtr<SharedMessage> slot;
+        for (int i = 0; i < 1000; ++i) {
+            slot.Store(IntrusivePtr<SharedMessage>(new SharedMessage(i)));
+            REQUIRE(HazardDomain::NumRetired() < 1000);
+        }
+        REQUIRE(SharedMessage::NumAlive() <= HazardDomain::NumRetired() + 1);
+        slot.Store(nullptr);
+        HazardDomain::Scan();
+        REQUIRE(SharedMessage::NumAlive() == 0);
+    }
+
+    SECTION("Readers and writers") {
+        constexpr int kNumReaders = 4;
+        constexpr int kNumWrites = 20'000;
+        HazardIntrusivePtr<SharedMessage> slot(IntrusivePtr<SharedMessage>(new SharedMessage(0)));
+        std::atomic<bool> done = false;
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < kNumReaders; ++i) {
+            readers.emplace_back([&] {
+                HazardPointer hazard;
+                int last = 0;
+                while (!done.load()) {
+                    SharedMessage* message = slot.Protect(hazard);
+                    if (message->id < last) {
+                        ++mismatches;
+                    }
+                    last = message->id;
+                }
+            });
+        }
+        std::thread writer([&] {
+            for (int i = 1; i <= kNumWrites; ++i) {
+                slot.Store(IntrusivePtr<SharedMessage>(new SharedMessage(i)));
+            }
+            done = true;
+        });
+        writer.join();
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        REQUIRE(mismatches == 0);
+        REQUIRE(slot.Load()->id == kNumWrites);
+        slot.Store(nullptr);
+        // The writer has exited: what it could not reclaim goes to the next scan.
+        HazardDomain::Scan();
+        REQUIRE(SharedMessage::NumAlive() == 0);
+    }
 }
@@ -0,0 +1,173 @@
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <functional>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Session : public EnableSharedFromThis<Session> {
+    int id = 0;
+};
+
+struct LoggedSession : public Session {
+    explicit LoggedSession(int log_id) : log_id(log_id) {
+    }
+
+    int log_id;
+};
+
+class EventLoop {
+public:
+    void Post(std::function<void()> callback) {
+        callbacks_.push_back(std::move(callback));
+    }
+
+    void Run() {
+        for (auto& callback : callbacks_) {
+            callback();
+        }
+        callbacks_.clear();
+    }
+
+    size_t Pending() const {
+        return callbacks_.size();
+    }
+
+private:
+    std::vector<std::function<void()>> callbacks_;
+};
+
+struct Connection : public EnableSharedFromThis<Connection, AtomicCounter> {
+    int received = 0;
+
+    void Start(EventLoop& loop) {
+        loop.Post([self = SharedFromThis()] { ++self->received; });
+    }
+
+    void Watch(EventLoop& loop, bool* fired) {
+        loop.Post([weak = WeakFromThis(), fired] { *fired = !weak.Expired(); });
+    }
+};
+
+TEST_CASE("SharedFromThis") {
+    SECTION("From MakeShared") {
+        auto sp = MakeShared<Session>();
+        auto other = sp->SharedFromThis();
+        REQUIRE(other.Get() == sp.Get());
+        REQUIRE(sp.UseCount() == 2);
+        REQUIRE(sp.UseWeakCount() == 1);
+    }
+
+    SECTION("From a raw pointer") {
+        SharedPtr<Session> sp(new Session());
+        auto other = sp->SharedFromThis();
+        REQUIRE(other.Get() == sp.Get());
+        REQUIRE(sp.UseCount() == 2);
+
+        sp.Reset(new Session());
+        REQUIRE(sp->SharedFromThis().Get() == sp.Get());
+        REQUIRE(other.UseCount() == 1);
+    }
+
+    SECTION("Deleter and allocator") {
+        SharedPtr<Session> sp(new Session(), std::default_delete<Session>());
+        REQUIRE(sp->SharedFromThis().Get() == sp.Get());
+        auto allocated = AllocateShared<Session>(std::allocator<Session>());
+        REQUIRE(allocated->SharedFromThis().Get() == allocated.Get());
+    }
+
+    SECTION("Derived and base pointers") {
+        SharedPtr<Session> sp = MakeShared<LoggedSession>(7);
+        SharedPtr<Session> self = sp->SharedFromThis();
+        REQUIRE(static_cast<LoggedSession*>(self.Get())->log_id == 7);
+
+        SharedPtr<Session> base(new LoggedSession(8));
+        REQUIRE(base->SharedFromThis().Get() == base.Get());
+    }
+
+    SECTION("Const") {
+        const auto sp = MakeShared<Session>();
+        const Session& session = *sp;
+        SharedPtr<const Session> self = session.SharedFromThis();
+        REQUIRE(self.Get() == sp.Get());
+        REQUIRE(sp.UseCount() == 2);
+    }
+
+    SECTION("Not owned") {
+        Session session;
+        REQUIRE_THROWS_AS(session.SharedFromThis(), BadWeakPtr);
+        REQUIRE(session.WeakFromThis().Expired());
+
+        auto* raw = new Session();
+        REQUIRE_THROWS_AS(raw->SharedFromThis(), BadWeakPtr);
+        SharedPtr<Session> sp(raw);
+        REQUIRE(raw->SharedFromThis().Get() == raw);
+    }
+
+    SECTION("Copies are not shared") {
+        auto sp = MakeShared<Session>();
+        Session copy = *sp;
+        REQUIRE_THROWS_AS(copy.SharedFromThis(), BadWeakPtr);
+        *sp = copy;
+        REQUIRE(sp->SharedFromThis().Get() == sp.Get());
+    }
+
+    SECTION("First owner wins") {
+        auto sp = MakeShared<Session>();
+        SharedPtr<Session> unowned(sp.Get(), [](Session*) {});
+        REQUIRE(unowned->SharedFromThis().UseCount() == 2);
+        REQUIRE(unowned.UseCount() == 1);
+    }
+}
+
+TEST_CASE("WeakFromThis") {
+    auto sp = MakeShared<Session>();
+    WeakPtr<Session> weak = sp->WeakFromThis();
+    REQUIRE(weak.Lock().Get() == sp.Get());
+    REQUIRE(sp.UseWeakCount() == 2);
+
+    const Session& session = *sp;
+    WeakPtr<const Session> const_weak = session.WeakFromThis();
+    REQUIRE(!const_weak.Expired());
+
+    sp.Reset();
+    REQUIRE(weak.Expired());
+    REQUIRE(const_weak.Expired());
+}
+
+TEST_CASE("No extra allocations") {
+    auto sp = MakeShared<Session>();
+    EXPECT_ZERO_ALLOCATIONS(MakeShared<Session>());
+    EXPECT_ZERO_ALLOCATIONS(REQUIRE(sp->SharedFromThis().Get() == sp.Get()));
+    EXPECT_ZERO_ALLOCATIONS(REQUIRE(!sp->WeakFromThis().Expired()));
+}
+
+TEST_CASE("Callbacks") {
+    EventLoop loop;
+
+    SECTION("Keeps the object alive") {
+        WeakPtr<Connection, AtomicCounter> weak;
+        {
+            auto connection = MakeShared<Connection, AtomicCounter>();
+            connection->Start(loop);
+            weak = connection;
+        }
+        REQUIRE(!weak.Expired());
+        REQUIRE(weak.Lock()->received == 0);
+        loop.Run();
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Does not keep the object alive") {
+        bool fired = true;
+        MakeShared<Connection, AtomicCounter>()->Watch(loop, &fired);
+        REQUIRE(loop.Pending() == 1);
+        loop.Run();
+        REQUIRE(!fired);
+    }
+}
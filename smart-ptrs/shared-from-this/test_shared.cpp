@@ -0,0 +1,770 @@
+#include <weak/shared.h>
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <array>
+#include <memory>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Empty") {
+    SECTION("Empty state") {
+        SharedPtr<int> a, b;
+
+        b = a;
+        SharedPtr c(a);
+        b = std::move(c);
+
+        REQUIRE(a.Get() == nullptr);
+        REQUIRE(b.Get() == nullptr);
+        REQUIRE(c.Get() == nullptr);
+    }
+
+    SECTION("No allocations in default ctor") {
+        EXPECT_ZERO_ALLOCATIONS(SharedPtr<int>());
+        EXPECT_ZERO_ALLOCATIONS(SharedPtr<int>(nullptr));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Copy/move") {
+    SharedPtr<std::string> a(new std::string("aba"));
+    std::string* ptr;
+    {
+        SharedPtr b(a);
+        SharedPtr c(a);
+        ptr = c.Get();
+    }
+    REQUIRE(ptr == a.Get());
+    REQUIRE(*ptr == "aba");
+
+    SharedPtr<std::string> b(new std::string("caba"));
+    {
+        SharedPtr c(b);
+        SharedPtr d(b);
+        d = std::move(a);
+        REQUIRE(*c == "caba");
+        REQUIRE(*d == "aba");
+        b.Reset(new std::string("test"));
+        REQUIRE(*c == "caba");
+    }
+    REQUIRE(*b == "test");
+
+    SharedPtr<std::string> end;
+    {
+        SharedPtr<std::string> d(new std::string("delete"));
+        d = b;
+        SharedPtr c(std::move(b));
+        REQUIRE(*d == "test");
+        REQUIRE(*c == "test");
+        d = d;
+        c = end;
+        d.Reset(new std::string("delete"));
+        end = d;
+    }
+
+    REQUIRE(*end == "delete");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct ModifiersB {
+    static int count;
+
+    ModifiersB() {
+        ++count;
+    }
+    ModifiersB(const ModifiersB&) {
+        ++count;
+    }
+    virtual ~ModifiersB() {
+        --count;
+    }
+};
+
+int ModifiersB::count = 0;
+
+struct ModifiersA : public ModifiersB {
+    static int count;
+
+    ModifiersA() {
+        ++count;
+    }
+    ModifiersA(const ModifiersA& other) : ModifiersB(other) {
+        ++count;
+    }
+    ~ModifiersA() {
+        --count;
+    }
+};
+
+int ModifiersA::count = 0;
+
+struct ModifiersC {
+    static int count;
+
+    ModifiersC() {
+        ++count;
+    }
+    ModifiersC(const ModifiersC&) {
+        ++count;
+    }
+    ~ModifiersC() {
+        --count;
+    }
+};
+
+int ModifiersC::count = 0;
+
+TEST_CASE("Modifiers") {
+    SECTION("Reset") {
+        {
+            SharedPtr<ModifiersB> p(new ModifiersB);
+            p.Reset();
+            REQUIRE(ModifiersA::count == 0);
+            REQUIRE(ModifiersB::count == 0);
+            REQUIRE(p.UseCount() == 0);
+            REQUIRE(p.Get() == nullptr);
+        }
+        REQUIRE(ModifiersA::count == 0);
+        {
+            SharedPtr<ModifiersB> p;
+            p.Reset();
+            REQUIRE(ModifiersA::count == 0);
+            REQUIRE(ModifiersB::count == 0);
+            REQUIRE(p.UseCount() == 0);
+            REQUIRE(p.Get() == nullptr);
+        }
+        REQUIRE(ModifiersA::count == 0);
+    }
+
+    SECTION("Reset ptr") {
+        {
+            SharedPtr<ModifiersB> p(new ModifiersB);
+            ModifiersA* ptr = new ModifiersA;
+            p.Reset(ptr);
+            REQUIRE(ModifiersA::count == 1);
+            REQUIRE(ModifiersB::count == 1);
+            REQUIRE(p.UseCount() == 1);
+            REQUIRE(p.Get() == ptr);
+        }
+        REQUIRE(ModifiersA::count == 0);
+        {
+            SharedPtr<ModifiersB> p;
+            ModifiersA* ptr = new ModifiersA;
+            p.Reset(ptr);
+            REQUIRE(ModifiersA::count == 1);
+            REQUIRE(ModifiersB::count == 1);
+            REQUIRE(p.UseCount() == 1);
+            REQUIRE(p.Get() == ptr);
+        }
+        REQUIRE(ModifiersA::count == 0);
+    }
+
+    SECTION("Swap") {
+        {
+            ModifiersC* ptr1 = new ModifiersC;
+            ModifiersC* ptr2 = new ModifiersC;
+            SharedPtr<ModifiersC> p1(ptr1);
+            {
+                SharedPtr<ModifiersC> p2(ptr2);
+                p1.Swap(p2);
+                REQUIRE(p1.UseCount() == 1);
+                REQUIRE(p1.Get() == ptr2);
+                REQUIRE(p2.UseCount() == 1);
+                REQUIRE(p2.Get() == ptr1);
+                REQUIRE(ModifiersC::count == 2);
+            }
+            REQUIRE(p1.UseCount() == 1);
+            REQUIRE(p1.Get() == ptr2);
+            REQUIRE(ModifiersC::count == 1);
+        }
+        REQUIRE(ModifiersC::count == 0);
+        {
+            ModifiersC* ptr1 = new ModifiersC;
+            ModifiersC* ptr2 = nullptr;
+            SharedPtr<ModifiersC> p1(ptr1);
+            {
+                SharedPtr<ModifiersC> p2;
+                p1.Swap(p2);
+                REQUIRE(p1.UseCount() == 0);
+                REQUIRE(p1.Get() == ptr2);
+                REQUIRE(p2.UseCount() == 1);
+                REQUIRE(p2.Get() == ptr1);
+                REQUIRE(ModifiersC::count == 1);
+            }
+            REQUIRE(p1.UseCount() == 0);
+            REQUIRE(p1.Get() == ptr2);
+            REQUIRE(ModifiersC::count == 0);
+        }
+        REQUIRE(ModifiersC::count == 0);
+        {
+            ModifiersC* ptr1 = nullptr;
+            ModifiersC* ptr2 = new ModifiersC;
+            SharedPtr<ModifiersC> p1;
+            {
+                SharedPtr<ModifiersC> p2(ptr2);
+                p1.Swap(p2);
+                REQUIRE(p1.UseCount() == 1);
+                REQUIRE(p1.Get() == ptr2);
+                REQUIRE(p2.UseCount() == 0);
+                REQUIRE(p2.Get() == ptr1);
+                REQUIRE(ModifiersC::count == 1);
+            }
+            REQUIRE(p1.UseCount() == 1);
+            REQUIRE(p1.Get() == ptr2);
+            REQUIRE(ModifiersC::count == 1);
+        }
+        REQUIRE(ModifiersC::count == 0);
+        {
+            ModifiersC* ptr1 = nullptr;
+            ModifiersC* ptr2 = nullptr;
+            SharedPtr<ModifiersC> p1;
+            {
+                SharedPtr<ModifiersC> p2;
+                p1.Swap(p2);
+                REQUIRE(p1.UseCount() == 0);
+                REQUIRE(p1.Get() == ptr2);
+                REQUIRE(p2.UseCount() == 0);
+                REQUIRE(p2.Get() == ptr1);
+                REQUIRE(ModifiersC::count == 0);
+            }
+            REQUIRE(p1.UseCount() == 0);
+            REQUIRE(p1.Get() == ptr2);
+            REQUIRE(ModifiersC::count == 0);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct OperatorBoolA {
+    int a;
+    virtual ~OperatorBoolA(){};
+};
+
+TEST_CASE("Observers") {
+    SECTION("operator->") {
+        const SharedPtr<std::pair<int, int>> p(new std::pair<int, int>(3, 4));
+        REQUIRE(p->first == 3);
+        REQUIRE(p->second == 4);
+        p->first = 5;
+        p->second = 6;
+        REQUIRE(p->first == 5);
+        REQUIRE(p->second == 6);
+    }
+
+    SECTION("Dereference") {
+        const SharedPtr<int> p(new int(32));
+        REQUIRE(*p == 32);
+        *p = 3;
+        REQUIRE(*p == 3);
+    }
+
+    SECTION("operator bool") {
+        static_assert(std::is_constructible<bool, SharedPtr<OperatorBoolA>>::value, "");
+        static_assert(!std::is_convertible<SharedPtr<OperatorBoolA>, bool>::value, "");
+        {
+            const SharedPtr<int> p(new int(32));
+            REQUIRE(p);
+        }
+        {
+            const SharedPtr<int> p;
+            REQUIRE(!p);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Pinned {
+    Pinned(int tag) : tag_(tag) {
+    }
+
+    Pinned(const Pinned& a) = delete;
+    Pinned(Pinned&& a) = delete;
+
+    Pinned& operator=(const Pinned& a) = delete;
+    Pinned& operator=(Pinned&& a) = delete;
+
+    ~Pinned() = default;
+
+    int GetTag() const {
+        return tag_;
+    }
+
+private:
+    int tag_;
+};
+
+TEST_CASE("No copies") {
+    SharedPtr<Pinned> p(new Pinned(1));
+}
+
+struct D {
+    D(Pinned& pinned, std::unique_ptr<int>&& p)
+        : some_uncopyable_thing_(std::move(p)), pinned_(pinned) {
+    }
+
+    int GetUP() const {
+        return *some_uncopyable_thing_;
+    }
+
+    Pinned& GetPinned() const {
+        return pinned_;
+    }
+
+private:
+    std::unique_ptr<int> some_uncopyable_thing_;
+    Pinned& pinned_;
+};
+
+struct Throwing {
+    Throwing() {
+        throw 42;
+    }
+};
+
+TEST_CASE("MakeShared") {
+    SECTION("One allocation") {
+        // Too large for the slab, so the block comes from the global heap in one piece.
+        EXPECT_ONE_ALLOCATION(REQUIRE(MakeShared<std::array<char, 1024>>()->size() == 1024));
+    }
+
+    SECTION("No allocations once the slab is warm") {
+        MakeShared<int>(0);
+        EXPECT_ZERO_ALLOCATIONS(REQUIRE(*MakeShared<int>(42) == 42));
+        int* ptr = new int(42);
+        EXPECT_ZERO_ALLOCATIONS(SharedPtr<int>{ptr});
+    }
+
+    SECTION("Parameters passing") {
+        auto p_int = std::make_unique<int>(42);
+        Pinned pinned(1312);
+        auto p = MakeShared<D>(pinned, std::move(p_int));
+
+        REQUIRE(p->GetUP() == 42);
+        REQUIRE(p->GetPinned().GetTag() == 1312);
+    }
+
+    SECTION("Constructed only once") {
+        auto sp = MakeShared<Pinned>(1);
+    }
+
+    SECTION("Faulty constructor") {
+        try {
+            auto sp = MakeShared<Throwing>();
+        } catch (...) {
+        }
+    }
+
+    SECTION("For overwrite") {
+        struct Tagged {
+            int tag = 3;
+        };
+        REQUIRE(MakeSharedForOverwrite<Tagged>()->tag == 3);
+        auto buffer = MakeSharedForOverwrite<std::array<char, 1024>>();
+        buffer->fill('x');
+        REQUIRE((*buffer)[1023] == 'x');
+    }
+}
+
+struct Data {
+    static bool data_was_deleted;
+
+    int x;
+    double y;
+
+    ~Data() {
+        data_was_deleted = true;
+    }
+};
+
+bool Data::data_was_deleted = false;
+
+TEST_CASE("Aliasing constructor") {
+    SECTION("It just exists") {
+        SharedPtr<Data> sp(new Data{42, 3.14});
+
+        SharedPtr<double> sp2(sp, &sp->y);
+
+        REQUIRE(*sp2 == 3.14);
+    }
+
+    SECTION("Lifetime extension") {
+        {
+            Data::data_was_deleted = false;
+            SharedPtr<double> sp3;
+            {
+                SharedPtr<Data> sp(new Data{42, 3.14});
+                SharedPtr<double> sp2(sp, &sp->y);
+                sp3 = sp2;
+            }
+            REQUIRE(*sp3 == 3.14);
+            REQUIRE(!Data::data_was_deleted);
+        }
+        REQUIRE(Data::data_was_deleted);
+    }
+}
+
+class Base {
+public:
+    virtual ~Base() = default;
+};
+
+class Derived : public Base {
+public:
+    static bool i_was_deleted;
+
+    ~Derived() {
+        i_was_deleted = true;
+    }
+};
+
+bool Derived::i_was_deleted = false;
+
+TEST_CASE("Type conversions") {
+    SECTION("Destruction") {
+        Derived::i_was_deleted = false;
+        { SharedPtr<Base> sb(new Derived); }
+        REQUIRE(Derived::i_was_deleted);
+    }
+
+    SECTION("Constness") {
+        SharedPtr<int> s1(new int(42));
+        SharedPtr<const int> s2 = s1;
+
+        SharedPtr<const int> s3 = std::move(s1);
+        REQUIRE(!s1);
+        REQUIRE(s2.UseCount() == 2);
+
+        s1.Reset(new int(43));
+        s2 = s1;
+        s3 = std::move(s1);
+        REQUIRE(!s1);
+        REQUIRE(s3.UseCount() == 2);
+    }
+}
+
+struct A {
+    ~A() = default;
+};
+
+struct B : A {
+    ~B() {
+        destructor_called = true;
+    }
+
+    static bool destructor_called;
+};
+
+bool B::destructor_called = false;
+
+TEST_CASE("Destructor for correct type") {
+    SECTION("Regular constructor") {
+        B::destructor_called = false;
+        { SharedPtr<A>(new B()); }
+        REQUIRE(B::destructor_called);
+    }
+
+    SECTION("MakeShared") {
+        B::destructor_called = false;
+        { SharedPtr<A> ptr = MakeShared<B>(); }
+        REQUIRE(B::destructor_called);
+    }
+
+    SECTION("Reset") {
+        B::destructor_called = false;
+        {
+            SharedPtr<A> ptr(new A);
+            ptr.Reset(new B);
+        }
+        REQUIRE(B::destructor_called);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct AllocatorStats {
+    size_t allocated = 0;
+    size_t deallocated = 0;
+};
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    CountingAllocator(AllocatorStats* stats) : stats(stats) {
+    }
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : stats(other.stats) {
+    }
+
+    T* allocate(size_t n) {
+        stats->allocated += n * sizeof(T);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        stats->deallocated += n * sizeof(T);
+        ::operator delete(ptr);
+    }
+
+    AllocatorStats* stats;
+};
+
+template <typename T>
+struct BufferAllocator {
+    using value_type = T;
+
+    BufferAllocator(char* buffer) : buffer(buffer) {
+    }
+
+    template <typename U>
+    BufferAllocator(const BufferAllocator<U>& other) : buffer(other.buffer) {
+    }
+
+    T* allocate(size_t) {
+        return reinterpret_cast<T*>(buffer);
+    }
+
+    void deallocate(T*, size_t) {
+    }
+
+    char* buffer;
+};
+
+template <typename T>
+struct EmptyAllocator : std::allocator<T> {
+    EmptyAllocator() = default;
+
+    template <typename U>
+    EmptyAllocator(const EmptyAllocator<U>&) {
+    }
+
+    template <typename U>
+    struct rebind {
+        using other = EmptyAllocator<U>;
+    };
+};
+
+TEST_CASE("AllocateShared") {
+    SECTION("Block goes through the allocator") {
+        AllocatorStats stats;
+        {
+            auto sp = AllocateShared<std::string>(CountingAllocator<char>(&stats), "allocated");
+            REQUIRE(*sp == "allocated");
+            REQUIRE(stats.allocated > sizeof(std::string));
+            REQUIRE(stats.deallocated == 0);
+        }
+        REQUIRE(stats.allocated == stats.deallocated);
+    }
+
+    SECTION("No global allocations") {
+        alignas(std::max_align_t) char buffer[64];
+        BufferAllocator<int> alloc(buffer);
+        EXPECT_ZERO_ALLOCATIONS(REQUIRE(*AllocateShared<int>(alloc, 42) == 42));
+    }
+
+    SECTION("Empty allocator takes no space") {
+        using Block = ControlBlockObjectAllocator<int, EmptyAllocator<int>, SingleThreadedCounter>;
+        REQUIRE(sizeof(Block) == sizeof(ControlBlockObject<int, SingleThreadedCounter>));
+    }
+
+    SECTION("Faulty constructor") {
+        AllocatorStats stats;
+        REQUIRE_THROWS(AllocateShared<Throwing>(CountingAllocator<Throwing>(&stats)));
+        REQUIRE(stats.allocated == stats.deallocated);
+    }
+
+    SECTION("Type conversions") {
+        B::destructor_called = false;
+        AllocatorStats stats;
+        { SharedPtr<A> ptr = AllocateShared<B>(CountingAllocator<B>(&stats)); }
+        REQUIRE(B::destructor_called);
+        REQUIRE(stats.allocated == stats.deallocated);
+    }
+}
+
+TEST_CASE("Deleter and allocator") {
+    SECTION("Custom deleter") {
+        int deleted = 0;
+        {
+            SharedPtr<int> sp(new int(42), [&deleted](int* ptr) {
+                ++deleted;
+                delete ptr;
+            });
+            SharedPtr<int> copy = sp;
+            REQUIRE(*copy == 42);
+        }
+        REQUIRE(deleted == 1);
+    }
+
+    SECTION("Block goes through the allocator") {
+        AllocatorStats stats;
+        {
+            SharedPtr<int> sp(new int(42), [](int* ptr) { delete ptr; },
+                              CountingAllocator<int>(&stats));
+            REQUIRE(stats.allocated > 0);
+            sp.Reset(new int(43), [](int* ptr) { delete ptr; }, CountingAllocator<int>(&stats));
+            REQUIRE(*sp == 43);
+        }
+        REQUIRE(stats.allocated == stats.deallocated);
+    }
+
+    SECTION("Empty deleter and allocator take no space") {
+        struct EmptyDeleter {
+            void operator()(int* ptr) const {
+                delete ptr;
+            }
+        };
+        REQUIRE(sizeof(ControlBlockPtrAllocator<int, EmptyDeleter, EmptyAllocator<int>,
+                                                SingleThreadedCounter>) ==
+                sizeof(ControlBlockPtr<int, SingleThreadedCounter>));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Element {
+    inline static int alive = 0;
+    inline static int throw_after = -1;
+
+    int value = 7;
+
+    Element() {
+        if (throw_after == 0) {
+            throw 42;
+        }
+        --throw_after;
+        ++alive;
+    }
+
+    Element(const Element& other) : Element() {
+        value = other.value;
+    }
+
+    ~Element() {
+        --alive;
+    }
+};
+
+TEST_CASE("Arrays") {
+    SECTION("Owns new[]") {
+        {
+            SharedPtr<Element[]> sp(new Element[3]);
+            SharedPtr<Element[]> copy = sp;
+            REQUIRE(Element::alive == 3);
+            REQUIRE(copy[2].value == 7);
+            sp.Reset(new Element[2]);
+            REQUIRE(Element::alive == 5);
+        }
+        REQUIRE(Element::alive == 0);
+    }
+
+    SECTION("MakeShared for unbounded arrays") {
+        auto sp = MakeShared<int[]>(5);
+        for (int i = 0; i < 5; ++i) {
+            REQUIRE(sp[i] == 0);
+        }
+        sp[3] = 42;
+        REQUIRE(sp.Get()[3] == 42);
+
+        auto filled = MakeShared<int[]>(4, 17);
+        REQUIRE(filled[0] == 17);
+        REQUIRE(filled[3] == 17);
+
+        REQUIRE(MakeShared<int[]>(0).UseCount() == 1);
+    }
+
+    SECTION("MakeShared for bounded arrays") {
+        {
+            auto sp = MakeShared<Element[4]>();
+            REQUIRE(Element::alive == 4);
+            Element init;
+            init.value = 9;
+            auto filled = MakeShared<Element[2]>(init);
+            REQUIRE(filled[1].value == 9);
+        }
+        REQUIRE(Element::alive == 0);
+    }
+
+    SECTION("One allocation") {
+        EXPECT_ONE_ALLOCATION(MakeShared<int[]>(1000));
+        MakeShared<int[]>(4);
+        EXPECT_ZERO_ALLOCATIONS(MakeShared<int[]>(4));
+    }
+
+    SECTION("Over-aligned elements") {
+        struct alignas(64) Aligned {
+            char data[64];
+        };
+        auto sp = MakeShared<Aligned[]>(3);
+        for (int i = 0; i < 3; ++i) {
+            REQUIRE(reinterpret_cast<uintptr_t>(&sp[i]) % 64 == 0);
+        }
+    }
+
+    SECTION("Faulty element constructor") {
+        Element::throw_after = 2;
+        REQUIRE_THROWS(MakeShared<Element[]>(5));
+        Element::throw_after = -1;
+        REQUIRE(Element::alive == 0);
+    }
+
+    SECTION("MakeSharedForOverwrite") {
+        {
+            auto sp = MakeSharedForOverwrite<Element[]>(3);
+            REQUIRE(Element::alive == 3);
+            REQUIRE(sp[2].value == 7);
+            auto bounded = MakeSharedForOverwrite<Element[2]>();
+            REQUIRE(Element::alive == 5);
+        }
+        REQUIRE(Element::alive == 0);
+
+        auto buffer = MakeSharedForOverwrite<char[]>(1 << 20);
+        buffer[(1 << 20) - 1] = 'x';
+        REQUIRE(buffer[(1 << 20) - 1] == 'x');
+        EXPECT_ONE_ALLOCATION(MakeSharedForOverwrite<char[]>(32 << 10));
+    }
+
+    SECTION("Aliasing an element") {
+        auto sp = MakeShared<int[]>(3, 1);
+        SharedPtr<int> element(sp, &sp[1]);
+        sp.Reset();
+        REQUIRE(*element == 1);
+        REQUIRE(element.UseCount() == 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct ChainNode {
+    SharedPtr<ChainNode> next;
+};
+
+TEST_CASE("Long chains") {
+    SECTION("Destroyed without recursion") {
+        SharedPtr<ChainNode> head;
+        for (int i = 0; i < 1'000'000; ++i) {
+            auto node = MakeShared<ChainNode>();
+            node->next = std::move(head);
+            head = std::move(node);
+        }
+        head.Reset();
+    }
+
+    SECTION("Shared tail stays alive") {
+        auto tail = MakeShared<ChainNode>();
+        auto head = MakeShared<ChainNode>();
+        head->next = MakeShared<ChainNode>();
+        head->next->next = tail;
+        head.Reset();
+        REQUIRE(tail.UseCount() == 1);
+    }
+}
@@ -0,0 +1,1085 @@
+#include <weak/shared.h>
+#include <weak/weak.h>
+#include <weak/biased_counter.h>
+#include <weak/atomic_shared.h>
+#include <weak/deferred_counter.h>
+#include <weak/borrowed.h>
+#include <weak/cycle_collector.h>
+#include <weak/hazard_shared.h>
+#include <weak/snapshot.h>
+
+#include <common/my_int.h>
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Empty weak") {
+    WeakPtr<int> a;
+    WeakPtr<int> b;
+    a = b;
+    WeakPtr c(a);
+    b = std::move(c);
+
+    auto shared = b.Lock();
+    REQUIRE(shared.Get() == nullptr);
+}
+
+TEST_CASE("No unexpected allocations") {
+    EXPECT_ZERO_ALLOCATIONS(WeakPtr<int>{});
+
+    auto sp = MakeShared<int>(42);
+    EXPECT_ZERO_ALLOCATIONS(WeakPtr<int>{sp});
+
+    SharedPtr<int> sp2(new int(42));
+    EXPECT_ZERO_ALLOCATIONS(WeakPtr<int>{sp2});
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Copy/move WeakPtr") {
+    SharedPtr<std::string> a(new std::string("aba"));
+    WeakPtr<std::string> b(a);
+    WeakPtr<std::string> empty;
+    WeakPtr c(b);
+    WeakPtr<std::string> d(a);
+
+    REQUIRE(d.UseCount() == 1);
+
+    REQUIRE(!c.Expired());
+    c = empty;
+    REQUIRE(c.Expired());
+
+    b = std::move(c);
+
+    WeakPtr e(std::move(d));
+    REQUIRE(d.Lock().Get() == nullptr);
+
+    auto locked = e.Lock();
+    REQUIRE(*locked == "aba");
+
+    WeakPtr<std::string> start(a);
+    {
+        SharedPtr a2(a);
+        WeakPtr<std::string> f(a2);
+        auto cur_lock = f.Lock();
+        REQUIRE(cur_lock.Get() == SharedPtr(start).Get());
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Modifiers WeakPtr") {
+    SECTION("Reset") {
+        {
+            SharedPtr<int> shared = MakeShared<int>(42), shared2 = shared, shared3 = shared2;
+            WeakPtr<int> weak = WeakPtr<int>{shared};
+            REQUIRE(shared.UseCount() == 3);
+            REQUIRE(weak.UseCount() == 3);
+            REQUIRE(!weak.Expired());
+            weak.Reset();
+            REQUIRE(shared.UseCount() == 3);
+            REQUIRE(weak.UseCount() == 0);
+            REQUIRE(weak.Expired());
+        }
+    }
+
+    SECTION("Reset deletes block") {
+        WeakPtr<int>* wp;
+        {
+            auto sp = MakeShared<int>();
+            wp = new WeakPtr<int>(sp);
+        }
+        wp->Reset();
+        delete wp;
+    }
+
+    SECTION("Swap") {
+        {
+            SharedPtr<int> shared = MakeShared<int>(42), shared3 = shared;
+            SharedPtr<int> shared2 = MakeShared<int>(13);
+            WeakPtr<int> weak = WeakPtr<int>{shared};
+            WeakPtr<int> weak2 = WeakPtr<int>{shared2};
+            REQUIRE(weak.UseCount() == 2);
+            REQUIRE(weak2.UseCount() == 1);
+            weak.Swap(weak2);
+            REQUIRE(weak.UseCount() == 1);
+            REQUIRE(weak2.UseCount() == 2);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Weak expiration") {
+    WeakPtr<std::string>* a;
+    {
+        SharedPtr<std::string> b(new std::string("aba"));
+        SharedPtr c(b);
+        a = new WeakPtr<std::string>(c);
+        auto test = a->Lock();
+        REQUIRE(*test == "aba");
+        REQUIRE(!a->Expired());
+    }
+    REQUIRE(a->Expired());
+    delete a;
+}
+
+TEST_CASE("Weak extends Shared") {
+    SharedPtr<std::string>* b = new SharedPtr<std::string>(new std::string("aba"));
+    WeakPtr<std::string> c(*b);
+    auto a = c.Lock();
+    delete b;
+    REQUIRE(!c.Expired());
+    REQUIRE(*a == "aba");
+}
+
+TEST_CASE("Shared from Weak") {
+    SharedPtr<std::string>* x = new SharedPtr<std::string>(new std::string("aba"));
+    WeakPtr<std::string> y(*x);
+    delete x;
+    REQUIRE(y.Expired());
+    SharedPtr z = y.Lock();
+    REQUIRE(z.Get() == nullptr);
+}
+
+TEST_CASE("Shared from invalid Weak") {
+    WeakPtr<int> w_ptr;
+    {
+        SharedPtr<int> ptr = MakeShared<int>(42);
+        w_ptr = ptr;
+    }
+    REQUIRE_THROWS_AS(SharedPtr<int>(w_ptr), BadWeakPtr);
+}
+
+TEST_CASE("Constness") {
+    SharedPtr<int> sp(new int(42));
+    WeakPtr<const int> wp(sp);
+}
+
+TEST_CASE("Lifetimes") {
+    SECTION("Destructor is called in time") {
+        WeakPtr<MyInt>* wp;
+        {
+            auto sp = MakeShared<MyInt>();
+
+            REQUIRE(MyInt::AliveCount() == 1);
+
+            wp = new WeakPtr<MyInt>(sp);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+        delete wp;
+    }
+
+    SECTION("Destructor is called once") {
+        WeakPtr<std::string>* wp;
+        {
+            auto sp = MakeShared<std::string>("looooooooooooooooooooooooooong");
+            wp = new WeakPtr<std::string>(sp);
+        }
+        delete wp;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Atomic counter") {
+    constexpr int kNumThreads = 4;
+    constexpr int kNumIters = 10000;
+
+    SECTION("Copies from many threads") {
+        auto sp = MakeShared<std::string, AtomicCounter>("shared");
+        WeakPtr<std::string, AtomicCounter> wp(sp);
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([sp, &mismatches] {
+                for (int j = 0; j < kNumIters; ++j) {
+                    SharedPtr copy = sp;
+                    WeakPtr<std::string, AtomicCounter> weak(copy);
+                    if (*weak.Lock() != "shared") {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(mismatches == 0);
+        REQUIRE(sp.UseCount() == 1);
+        REQUIRE(wp.UseWeakCount() == 1);
+    }
+
+    SECTION("Lock races with the last release") {
+        for (int i = 0; i < 100; ++i) {
+            SharedPtr<MyInt, AtomicCounter> sp(new MyInt(i));
+            WeakPtr<MyInt, AtomicCounter> wp(sp);
+            bool saw_value = true;
+            std::thread locker([wp, i, &saw_value] {
+                while (auto locked = wp.Lock()) {
+                    saw_value = saw_value && *locked == i;
+                }
+            });
+            sp.Reset();
+            locker.join();
+            REQUIRE(saw_value);
+            REQUIRE(wp.Expired());
+            REQUIRE(MyInt::AliveCount() == 0);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Biased counter") {
+    SECTION("Owner thread") {
+        {
+            auto sp = MakeShared<MyInt, BiasedCounter>(1);
+            SharedPtr copy = sp;
+            WeakPtr<MyInt, BiasedCounter> wp(copy);
+            REQUIRE(sp.UseCount() == 2);
+            copy.Reset();
+            REQUIRE(sp.UseCount() == 1);
+            REQUIRE(*wp.Lock() == 1);
+            REQUIRE(MyInt::AliveCount() == 1);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Released by another thread") {
+        auto sp = MakeShared<MyInt, BiasedCounter>(2);
+        WeakPtr<MyInt, BiasedCounter> wp(sp);
+        std::thread([copy = sp]() mutable { copy.Reset(); }).join();
+        REQUIRE(sp.UseCount() == 1);
+        REQUIRE(!wp.Expired());
+        sp.Reset();
+        REQUIRE(wp.Expired());
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Merged by the owner") {
+        auto sp = MakeShared<MyInt, BiasedCounter>(3);
+        SharedPtr<MyInt, BiasedCounter> keep = sp;
+        std::thread([moved = std::move(sp)]() mutable { moved.Reset(); }).join();
+        REQUIRE(keep.UseCount() == 1);
+        BiasedCounter::MergeQueued();
+        REQUIRE(keep.UseCount() == 1);
+        keep.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Owner has exited") {
+        SharedPtr<MyInt, BiasedCounter> sp;
+        WeakPtr<MyInt, BiasedCounter> wp;
+        std::thread([&sp, &wp] {
+            sp = MakeShared<MyInt, BiasedCounter>(4);
+            wp = sp;
+        }).join();
+        REQUIRE(*wp.Lock() == 4);
+        sp.Reset();
+        REQUIRE(wp.Expired());
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Many threads") {
+        auto sp = MakeShared<std::string, BiasedCounter>("biased");
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([sp, &mismatches] {
+                for (int j = 0; j < 10000; ++j) {
+                    SharedPtr copy = sp;
+                    WeakPtr<std::string, BiasedCounter> weak(copy);
+                    if (*weak.Lock() != "biased") {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(mismatches == 0);
+        REQUIRE(sp.UseCount() == 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Control block slab") {
+    SECTION("Blocks are reused") {
+        void* block = SlabAllocator::Allocate(40);
+        SlabAllocator::Deallocate(block, 40);
+        REQUIRE(SlabAllocator::Allocate(40) == block);
+        SlabAllocator::Deallocate(block, 40);
+    }
+
+    SECTION("Freed by another thread") {
+        constexpr size_t kSize = 200;
+        std::vector<void*> blocks;
+        for (int i = 0; i < 100; ++i) {
+            blocks.push_back(SlabAllocator::Allocate(kSize));
+        }
+        std::thread([&blocks] {
+            for (void* block : blocks) {
+                SlabAllocator::Deallocate(block, kSize);
+            }
+        }).join();
+        std::sort(blocks.begin(), blocks.end());
+        std::vector<void*> reused;
+        for (int i = 0; i < 100; ++i) {
+            reused.push_back(SlabAllocator::Allocate(kSize));
+        }
+        std::sort(reused.begin(), reused.end());
+        REQUIRE(reused == blocks);
+        for (void* block : reused) {
+            SlabAllocator::Deallocate(block, kSize);
+        }
+    }
+
+    SECTION("Owner has exited") {
+        std::vector<SharedPtr<MyInt, AtomicCounter>> pointers;
+        for (int i = 0; i < 4; ++i) {
+            std::thread([&pointers, i] {
+                for (int j = 0; j < 100; ++j) {
+                    pointers.push_back(MakeShared<MyInt, AtomicCounter>(i));
+                    pointers.emplace_back(new MyInt(j));
+                }
+            }).join();
+        }
+        REQUIRE(MyInt::AliveCount() == 800);
+        pointers.clear();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Producers and consumers") {
+        constexpr int kCount = 10000;
+        std::vector<SharedPtr<int, AtomicCounter>> pointers(kCount);
+        std::atomic<int> ready = 0;
+        std::thread producer([&] {
+            for (int i = 0; i < kCount; ++i) {
+                pointers[i] = MakeShared<int, AtomicCounter>(i);
+                ready.store(i + 1, std::memory_order_release);
+            }
+        });
+        std::atomic<int> mismatches = 0;
+        std::thread consumer([&] {
+            for (int i = 0; i < kCount; ++i) {
+                while (ready.load(std::memory_order_acquire) <= i) {
+                    std::this_thread::yield();
+                }
+                if (*pointers[i] != i) {
+                    ++mismatches;
+                }
+                pointers[i].Reset();
+            }
+        });
+        producer.join();
+        consumer.join();
+        REQUIRE(mismatches == 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Weak arrays") {
+    auto sp = MakeShared<MyInt[]>(3, MyInt(5));
+    WeakPtr<MyInt[]> wp(sp);
+    REQUIRE(wp.Lock()[2] == 5);
+    REQUIRE(MyInt::AliveCount() == 3);
+    sp.Reset();
+    REQUIRE(wp.Expired());
+    REQUIRE(MyInt::AliveCount() == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Large {
+    inline static int freed = 0;
+
+    char data[kSeparateObjectBytes];
+
+    static void* operator new(size_t size) {
+        return ::operator new(size);
+    }
+
+    static void operator delete(void* ptr) {
+        ++freed;
+        ::operator delete(ptr);
+    }
+};
+
+TEST_CASE("Weak references and object memory") {
+    SECTION("Small objects stay in the block") {
+        size_t before = ZombieBytes();
+        auto sp = MakeShared<std::array<char, 100>>();
+        WeakPtr<std::array<char, 100>> wp(sp);
+        sp.Reset();
+        REQUIRE(ZombieBytes() == before + 100);
+        wp.Reset();
+        REQUIRE(ZombieBytes() == before);
+
+        auto array = MakeShared<int[]>(10);
+        WeakPtr<int[]> weak_array(array);
+        array.Reset();
+        REQUIRE(ZombieBytes() == before + 10 * sizeof(int));
+        weak_array.Reset();
+        REQUIRE(ZombieBytes() == before);
+    }
+
+    SECTION("Large objects are freed with the last shared reference") {
+        size_t before = ZombieBytes();
+        Large::freed = 0;
+        auto sp = MakeShared<Large>();
+        WeakPtr<Large> wp(sp);
+        sp.Reset();
+        REQUIRE(Large::freed == 1);
+        REQUIRE(ZombieBytes() == before);
+        REQUIRE(wp.Expired());
+
+        sp = MakeSharedForOverwrite<Large>();
+        sp.Reset();
+        REQUIRE(Large::freed == 2);
+    }
+
+    SECTION("Large arrays are freed with the last shared reference") {
+        size_t before = ZombieBytes();
+        auto array = MakeShared<MyInt[]>(kSeparateObjectBytes / sizeof(MyInt), MyInt(1));
+        WeakPtr<MyInt[]> weak_array(array);
+        REQUIRE(array[kSeparateObjectBytes / sizeof(MyInt) - 1] == 1);
+        array.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+        REQUIRE(ZombieBytes() == before);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("AtomicSharedPtr") {
+    using Ptr = SharedPtr<MyInt, AtomicCounter>;
+
+    SECTION("Load and store") {
+        {
+            AtomicSharedPtr<MyInt> atomic;
+            REQUIRE(atomic.Load().Get() == nullptr);
+            Ptr first = MakeShared<MyInt, AtomicCounter>(1);
+            atomic.Store(first);
+            REQUIRE(first.UseCount() == 2);
+            Ptr loaded = atomic.Load();
+            REQUIRE(loaded.Get() == first.Get());
+            REQUIRE(*loaded == 1);
+            first.Reset();
+            atomic.Store(MakeShared<MyInt, AtomicCounter>(2));
+            REQUIRE(*loaded == 1);
+            REQUIRE(*atomic.Load() == 2);
+            REQUIRE(MyInt::AliveCount() == 2);
+            loaded.Reset();
+            REQUIRE(MyInt::AliveCount() == 1);
+            atomic.Store(nullptr);
+            REQUIRE(MyInt::AliveCount() == 0);
+            REQUIRE(atomic.Load().Get() == nullptr);
+            atomic.Store(MakeShared<MyInt, AtomicCounter>(3));
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Exchange") {
+        AtomicSharedPtr<MyInt> atomic(MakeShared<MyInt, AtomicCounter>(1));
+        Ptr old = atomic.Exchange(MakeShared<MyInt, AtomicCounter>(2));
+        REQUIRE(*old == 1);
+        REQUIRE(old.UseCount() == 1);
+        REQUIRE(*atomic.Load() == 2);
+        REQUIRE(atomic.Exchange(nullptr).UseCount() == 1);
+        REQUIRE(MyInt::AliveCount() == 1);
+        REQUIRE(atomic.Exchange(nullptr).Get() == nullptr);
+    }
+
+    SECTION("CompareExchange") {
+        Ptr first = MakeShared<MyInt, AtomicCounter>(1);
+        AtomicSharedPtr<MyInt> atomic(first);
+
+        Ptr expected = MakeShared<MyInt, AtomicCounter>(1);
+        REQUIRE(!atomic.CompareExchange(expected, MakeShared<MyInt, AtomicCounter>(2)));
+        REQUIRE(expected.Get() == first.Get());
+
+        REQUIRE(atomic.CompareExchange(expected, MakeShared<MyInt, AtomicCounter>(3)));
+        REQUIRE(*atomic.Load() == 3);
+
+        Ptr loaded = atomic.Load();
+        REQUIRE(atomic.CompareExchange(loaded, first));
+        REQUIRE(atomic.Load().Get() == first.Get());
+
+        expected = first;
+        REQUIRE(atomic.CompareExchange(expected, nullptr));
+        Ptr empty;
+        REQUIRE(atomic.CompareExchange(empty, first));
+        REQUIRE(atomic.Load().Get() == first.Get());
+    }
+
+    SECTION("Many loads") {
+        AtomicSharedPtr<MyInt> atomic(MakeShared<MyInt, AtomicCounter>(7));
+        std::vector<Ptr> loaded;
+        for (int i = 0; i < 100000; ++i) {
+            loaded.push_back(atomic.Load());
+        }
+        // While stored, the holder also counts the references prepaid for future loads.
+        REQUIRE(loaded.front().UseCount() > 100000);
+        atomic.Store(nullptr);
+        REQUIRE(loaded.back().UseCount() == 100000);
+        loaded.clear();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Readers and writers") {
+        AtomicSharedPtr<std::string> atomic(MakeShared<std::string, AtomicCounter>("0"));
+        std::atomic<bool> stop = false;
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&] {
+                while (!stop.load()) {
+                    auto value = atomic.Load();
+                    if (value->size() != 1) {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        threads.emplace_back([&] {
+            for (int i = 0; i < 20000; ++i) {
+                auto next = MakeShared<std::string, AtomicCounter>(std::to_string(i % 10));
+                if (i % 2 == 0) {
+                    atomic.Store(next);
+                } else {
+                    auto expected = atomic.Load();
+                    atomic.CompareExchange(expected, next);
+                }
+            }
+            stop.store(true);
+        });
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(mismatches == 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct DestroyedOn {
+    std::thread::id* thread;
+
+    ~DestroyedOn() {
+        *thread = std::this_thread::get_id();
+    }
+};
+
+struct Graph {
+    std::vector<SharedPtr<MyInt, DeferredCounter>> children;
+};
+
+TEST_CASE("Deferred counter") {
+    SECTION("Destroyed by the reclaimer") {
+        std::thread::id destroyed_on;
+        auto before = DeferredReclaimer::GetStats();
+        auto sp = MakeShared<DestroyedOn, DeferredCounter>(DestroyedOn{&destroyed_on});
+        WeakPtr<DestroyedOn, DeferredCounter> wp(sp);
+        sp.Reset();
+        REQUIRE(wp.Expired());
+        REQUIRE(wp.Lock().Get() == nullptr);
+        DeferredReclaimer::Flush();
+        REQUIRE(destroyed_on != std::thread::id());
+        REQUIRE(destroyed_on != std::this_thread::get_id());
+        auto after = DeferredReclaimer::GetStats();
+        REQUIRE(after.reclaimed == before.reclaimed + 1);
+        REQUIRE(after.queue_depth == 0);
+        REQUIRE(after.max_latency_ns >= before.max_latency_ns);
+        REQUIRE(after.total_latency_ns > before.total_latency_ns);
+    }
+
+    SECTION("Nested releases") {
+        {
+            auto graph = MakeShared<Graph, DeferredCounter>();
+            for (int i = 0; i < 1000; ++i) {
+                graph->children.push_back(MakeShared<MyInt, DeferredCounter>(i));
+            }
+            SharedPtr<MyInt, DeferredCounter> child = graph->children[10];
+            graph.Reset();
+            DeferredReclaimer::Flush();
+            REQUIRE(MyInt::AliveCount() == 1);
+            REQUIRE(*child == 10);
+        }
+        DeferredReclaimer::Flush();
+        REQUIRE(MyInt::AliveCount() == 0);
+        REQUIRE(DeferredReclaimer::GetStats().queue_depth == 0);
+    }
+
+    SECTION("Drain") {
+        for (int i = 0; i < 100; ++i) {
+            MakeShared<MyInt, DeferredCounter>(i);
+        }
+        DeferredReclaimer::Drain();
+        DeferredReclaimer::Flush();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Many threads") {
+        std::atomic<int> alive = 0;
+        struct Counted {
+            std::atomic<int>* alive;
+
+            explicit Counted(std::atomic<int>* alive) : alive(alive) {
+                ++*alive;
+            }
+
+            ~Counted() {
+                --*alive;
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&alive] {
+                for (int j = 0; j < 10000; ++j) {
+                    auto sp = MakeShared<Counted, DeferredCounter>(&alive);
+                    SharedPtr copy = sp;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        DeferredReclaimer::Flush();
+        REQUIRE(alive == 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int ReadBorrowed(Borrowed<MyInt> value, int depth) {
+    if (depth == 0) {
+        return *value == 5 ? static_cast<int>(value.Promote().UseCount()) : -1;
+    }
+    return ReadBorrowed(value, depth - 1);
+}
+
+TEST_CASE("Borrowed") {
+    SECTION("No reference counting") {
+        auto sp = MakeShared<MyInt>(5);
+        Borrowed<MyInt> borrowed(sp);
+        Borrowed<MyInt> copy = borrowed;
+        REQUIRE(sp.UseCount() == 1);
+        REQUIRE(copy.Get() == sp.Get());
+        REQUIRE(*copy == 5);
+        REQUIRE(ReadBorrowed(sp, 10) == 2);
+        REQUIRE(sp.UseCount() == 1);
+    }
+
+    SECTION("Promote") {
+        SharedPtr<MyInt> kept;
+        {
+            auto sp = MakeShared<MyInt>(5);
+            Borrowed<MyInt> borrowed(sp);
+            kept = borrowed.Promote();
+            REQUIRE(sp.UseCount() == 2);
+        }
+        REQUIRE(*kept == 5);
+        REQUIRE(kept.UseCount() == 1);
+        WeakPtr<MyInt> weak(kept);
+        kept.Reset();
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Empty") {
+        SharedPtr<MyInt> empty;
+        Borrowed<MyInt> borrowed(empty);
+        REQUIRE(!borrowed);
+        REQUIRE(borrowed.Promote().Get() == nullptr);
+    }
+
+    SECTION("Conversions") {
+        auto sp = MakeShared<std::string, AtomicCounter>("borrowed");
+        Borrowed<const std::string, AtomicCounter> borrowed(sp);
+        SharedPtr<const std::string, AtomicCounter> promoted = borrowed.Promote();
+        REQUIRE(*promoted == "borrowed");
+        REQUIRE(sp.UseCount() == 2);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("CloneN") {
+    SECTION("Copies") {
+        auto sp = MakeShared<MyInt>(3);
+        WeakPtr<MyInt> weak(sp);
+        std::vector<SharedPtr<MyInt>> copies(5);
+        CloneN(sp, copies);
+        REQUIRE(sp.UseCount() == 6);
+        REQUIRE(sp.UseWeakCount() == 1);
+        for (const auto& copy : copies) {
+            REQUIRE(copy.Get() == sp.Get());
+        }
+        sp.Reset();
+        copies.clear();
+        REQUIRE(weak.Expired());
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Replaces previous pointers") {
+        auto first = MakeShared<MyInt>(1);
+        auto second = MakeShared<MyInt>(2);
+        std::array<SharedPtr<MyInt>, 3> copies = {first, first, second};
+        first.Reset();
+        CloneN(second, copies);
+        REQUIRE(second.UseCount() == 4);
+        REQUIRE(MyInt::AliveCount() == 1);
+    }
+
+    SECTION("Source among the copies") {
+        std::array<SharedPtr<MyInt>, 3> copies = {MakeShared<MyInt>(4)};
+        CloneN(copies[0], copies);
+        REQUIRE(*copies[2] == 4);
+        REQUIRE(copies[0].UseCount() == 3);
+    }
+
+    SECTION("Empty") {
+        std::array<SharedPtr<MyInt>, 2> copies = {MakeShared<MyInt>(5)};
+        CloneN(SharedPtr<MyInt>(), copies);
+        REQUIRE(copies[0].Get() == nullptr);
+        REQUIRE(MyInt::AliveCount() == 0);
+        CloneN(MakeShared<MyInt>(6), std::span<SharedPtr<MyInt>>());
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Counters") {
+        auto atomic = MakeShared<std::string, AtomicCounter>("atomic");
+        std::vector<SharedPtr<std::string, AtomicCounter>> atomic_copies(4);
+        CloneN(atomic, atomic_copies);
+        REQUIRE(atomic.UseCount() == 5);
+
+        auto biased = MakeShared<std::string, BiasedCounter>("biased");
+        std::vector<SharedPtr<std::string, BiasedCounter>> biased_copies(4);
+        CloneN(biased, biased_copies);
+        REQUIRE(biased.UseCount() == 5);
+        std::thread([&] {
+            SharedPtr<std::string, BiasedCounter> copy = biased;
+            std::array<SharedPtr<std::string, BiasedCounter>, 2> more;
+            CloneN(copy, more);
+            biased_copies.clear();
+        }).join();
+        REQUIRE(biased.UseCount() == 1);
+    }
+
+    SECTION("No allocations") {
+        auto sp = MakeShared<MyInt>(7);
+        std::vector<SharedPtr<MyInt>> copies(100);
+        EXPECT_ZERO_ALLOCATIONS(CloneN(sp, copies));
+        REQUIRE(sp.UseCount() == 101);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+struct GraphNode {
+    using Ptr = SharedPtr<GraphNode, CycleCollectedCounter>;
+
+    MyInt value;
+    std::vector<Ptr> edges;
+    SharedPtr<MyInt, CycleCollectedCounter> leaf;
+
+    void Trace(CycleTracer& tracer) const {
+        for (const Ptr& edge : edges) {
+            tracer(edge);
+        }
+        tracer(leaf);
+    }
+};
+
+struct DerivedNode : GraphNode {
+    MyInt extra;
+};
+}  // namespace
+
+TEST_CASE("Cycle collector") {
+    using Ptr = GraphNode::Ptr;
+    auto make_node = [] { return MakeShared<GraphNode, CycleCollectedCounter>(); };
+    CycleCollector::Collect();
+
+    SECTION("Cycle") {
+        Ptr a = make_node();
+        Ptr b = make_node();
+        a->edges.push_back(b);
+        b->edges.push_back(a);
+        WeakPtr<GraphNode, CycleCollectedCounter> weak(a);
+        a.Reset();
+        REQUIRE(CycleCollector::NumCandidates() == 1);
+        REQUIRE(CycleCollector::Collect() == 0);
+        REQUIRE(MyInt::AliveCount() == 2);
+        b.Reset();
+        REQUIRE(CycleCollector::NumCandidates() == 1);
+        REQUIRE(CycleCollector::Collect() == 2);
+        REQUIRE(MyInt::AliveCount() == 0);
+        REQUIRE(weak.Expired());
+        REQUIRE(CycleCollector::NumCandidates() == 0);
+    }
+
+    SECTION("Self-loop") {
+        Ptr a = make_node();
+        a->edges.push_back(a);
+        a.Reset();
+        REQUIRE(CycleCollector::Collect() == 1);
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Live graph is kept") {
+        Ptr root = make_node();
+        Ptr ring = root;
+        for (int i = 0; i < 100; ++i) {
+            Ptr next = make_node();
+            next->edges.push_back(ring);
+            ring = next;
+        }
+        root->edges.push_back(ring);
+        Ptr outside = ring->edges[0];
+        ring.Reset();
+        root.Reset();
+        REQUIRE(CycleCollector::Collect() == 0);
+        REQUIRE(MyInt::AliveCount() == 101);
+        REQUIRE(outside.UseCount() == 2);
+        outside.Reset();
+        REQUIRE(CycleCollector::Collect() == 101);
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Long cycle") {
+        Ptr head = make_node();
+        Ptr tail = head;
+        for (int i = 0; i < 100'000; ++i) {
+            tail->edges.push_back(make_node());
+            tail = tail->edges[0];
+        }
+        tail->edges.push_back(head);
+        tail.Reset();
+        head.Reset();
+        REQUIRE(CycleCollector::Collect() == 100'001);
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Children outside the cycle") {
+        Ptr a = make_node();
+        Ptr b = make_node();
+        auto leaf = MakeShared<MyInt, CycleCollectedCounter>(7);
+        Ptr tail = make_node();
+        a->edges.push_back(b);
+        b->edges.push_back(a);
+        a->leaf = leaf;
+        b->edges.push_back(tail);
+        a.Reset();
+        b.Reset();
+        REQUIRE(CycleCollector::Collect() == 2);
+        REQUIRE(leaf.UseCount() == 1);
+        REQUIRE(*leaf == 7);
+        REQUIRE(tail.UseCount() == 1);
+        REQUIRE(MyInt::AliveCount() == 2);
+    }
+
+    SECTION("Owned through a base") {
+        Ptr a(new DerivedNode());
+        a->edges.push_back(a);
+        a.Reset();
+        REQUIRE(CycleCollector::Collect() == 1);
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Without collection") {
+        Ptr a = make_node();
+        Ptr b = make_node();
+        a->edges.push_back(b);
+        b->edges.push_back(a);
+        b.Reset();
+        a.Reset();
+        REQUIRE(MyInt::AliveCount() == 2);
+        // Collected when the thread exits.
+        std::thread([] {
+            Ptr c = MakeShared<GraphNode, CycleCollectedCounter>();
+            c->edges.push_back(c);
+            c.Reset();
+        }).join();
+        REQUIRE(MyInt::AliveCount() == 2);
+        REQUIRE(CycleCollector::Collect() == 2);
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+}
+
+TEST_CASE("HazardSharedPtr") {
+    HazardDomain::Scan();
+
+    SECTION("Protect and Load") {
+        HazardSharedPtr<MyInt> slot(MakeShared<MyInt, AtomicCounter>(1));
+        HazardPointer hazard;
+        MyInt* first = slot.Protect(hazard);
+        REQUIRE(*first == 1);
+        auto loaded = slot.Load();
+        REQUIRE(loaded.Get() == first);
+        REQUIRE(loaded.UseCount() == 2);
+        loaded.Reset();
+
+        slot.Store(MakeShared<MyInt, AtomicCounter>(2));
+        REQUIRE(HazardDomain::Scan() == 1);
+        REQUIRE(MyInt::AliveCount() == 2);
+        REQUIRE(*first == 1);
+        hazard.Reset();
+        REQUIRE(HazardDomain::Scan() == 0);
+        REQUIRE(MyInt::AliveCount() == 1);
+        REQUIRE(*slot.Load() == 2);
+    }
+
+    SECTION("Exchange") {
+        auto value = MakeShared<MyInt, AtomicCounter>(3);
+        HazardSharedPtr<MyInt> slot(value);
+        auto previous = slot.Exchange(nullptr);
+        REQUIRE(previous.Get() == value.Get());
+        REQUIRE(slot.Load().Get() == nullptr);
+        HazardPointer hazard;
+        REQUIRE(slot.Protect(hazard) == nullptr);
+        HazardDomain::Scan();
+        REQUIRE(value.UseCount() == 2);
+    }
+
+    SECTION("Readers and writers") {
+        constexpr int kNumReaders = 4;
+        constexpr int kNumWrites = 20'000;
+        HazardSharedPtr<std::vector<int>> slot(MakeShared<std::vector<int>, AtomicCounter>(8, 0));
+        std::atomic<bool> done = false;
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < kNumReaders; ++i) {
+            readers.emplace_back([&] {
+                HazardPointer hazard;
+                while (!done.load()) {
+                    const std::vector<int>& values = *slot.Protect(hazard);
+                    if (values.front() != values.back()) {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        for (int i = 1; i <= kNumWrites; ++i) {
+            slot.Store(MakeShared<std::vector<int>, AtomicCounter>(8, i));
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        REQUIRE(mismatches == 0);
+        REQUIRE(slot.Load()->front() == kNumWrites);
+    }
+}
+
+TEST_CASE("Snapshot") {
+    SECTION("Read and publish") {
+        Snapshot<MyInt> snapshot(MakeShared<MyInt, AtomicCounter>(1));
+        const auto& first = snapshot.Read();
+        REQUIRE(*first == 1);
+        // The snapshot and this thread's cache.
+        REQUIRE(first.UseCount() == 2);
+        REQUIRE(&snapshot.Read() == &first);
+        REQUIRE(first.UseCount() == 2);
+
+        snapshot.Publish(MakeShared<MyInt, AtomicCounter>(2));
+        REQUIRE(snapshot.Version() == 2);
+        REQUIRE(MyInt::AliveCount() == 2);
+        REQUIRE(*snapshot.Read() == 2);
+        REQUIRE(MyInt::AliveCount() == 1);
+        REQUIRE(*snapshot.Load() == 2);
+    }
+
+    SECTION("Several snapshots") {
+        std::vector<std::unique_ptr<Snapshot<MyInt>>> snapshots;
+        for (int i = 0; i < 10; ++i) {
+            snapshots.push_back(
+                std::make_unique<Snapshot<MyInt>>(MakeShared<MyInt, AtomicCounter>(i)));
+        }
+        const auto& first = snapshots[0]->Read();
+        for (int i = 0; i < 10; ++i) {
+            REQUIRE(*snapshots[i]->Read() == i);
+        }
+        REQUIRE(*first == 0);
+
+        // A new snapshot in a reused slot does not see the cached value of the old one.
+        snapshots[3].reset();
+        Snapshot<MyInt> reused(MakeShared<MyInt, AtomicCounter>(30));
+        REQUIRE(*reused.Read() == 30);
+    }
+
+    SECTION("Destruction releases the copies of all threads") {
+        auto snapshot = std::make_unique<Snapshot<MyInt>>(MakeShared<MyInt, AtomicCounter>(4));
+        std::atomic<bool> read = false;
+        std::atomic<bool> destroyed = false;
+        std::atomic<bool> correct = false;
+        std::thread reader([&] {
+            correct = *snapshot->Read() == 4;
+            read = true;
+            while (!destroyed.load()) {
+                std::this_thread::yield();
+            }
+        });
+        while (!read.load()) {
+            std::this_thread::yield();
+        }
+        REQUIRE(correct);
+        snapshot->Read();
+        snapshot.reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+        destroyed = true;
+        reader.join();
+    }
+
+    SECTION("Empty") {
+        Snapshot<MyInt> snapshot;
+        REQUIRE(snapshot.Read().Get() == nullptr);
+        snapshot.Publish(MakeShared<MyInt, AtomicCounter>(5));
+        REQUIRE(*snapshot.Read() == 5);
+    }
+
+    SECTION("Readers and a writer") {
+        constexpr int kNumReaders = 4;
+        constexpr int kNumWrites = 10'000;
+        Snapshot<std::vector<int>> snapshot(MakeShared<std::vector<int>, AtomicCounter>(8, 0));
+        std::atomic<bool> done = false;
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < kNumReaders; ++i) {
+            readers.emplace_back([&] {
+                int last = 0;
+                while (!done.load()) {
+                    const std::vector<int>& values = *snapshot.Read();
+                    if (values.front() != values.back() || values.front() < last) {
+                        ++mismatches;
+                    }
+                    last = values.front();
+                }
+            });
+        }
+        for (int i = 1; i <= kNumWrites; ++i) {
+            snapshot.Publish(MakeShared<std::vector<int>, AtomicCounter>(8, i));
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        REQUIRE(mismatches == 0);
+        // The readers have exited and released their copies.
+        REQUIRE(snapshot.Read().UseCount() == 2);
+    }
+}
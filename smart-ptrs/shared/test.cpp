@@ -4,6 +4,7 @@
 
 #include "allocations_checker.h"
 
+#include <array>
 #include <memory>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -330,7 +331,15 @@ struct Throwing {
 
 TEST_CASE("MakeShared") {
     SECTION("One allocation") {
-        EXPECT_ONE_ALLOCATION(REQUIRE(*MakeShared<int>(42) == 42));
+        // Too large for the slab, so the block comes from the global heap in one piece.
+        EXPECT_ONE_ALLOCATION(REQUIRE(MakeShared<std::array<char, 1024>>()->size() == 1024));
+    }
+
+    SECTION("No allocations once the slab is warm") {
+        MakeShared<int>(0);
+        EXPECT_ZERO_ALLOCATIONS(REQUIRE(*MakeShared<int>(42) == 42));
+        int* ptr = new int(42);
+        EXPECT_ZERO_ALLOCATIONS(SharedPtr<int>{ptr});
     }
 
     SECTION("Parameters passing") {
@@ -352,6 +361,16 @@ TEST_CASE("MakeShared") {
         } catch (...) {
         }
     }
+
+    SECTION("For overwrite") {
+        struct Tagged {
+            int tag = 3;
+        };
+        REQUIRE(MakeSharedForOverwrite<Tagged>()->tag == 3);
+        auto buffer = MakeSharedForOverwrite<std::array<char, 1024>>();
+        buffer->fill('x');
+        REQUIRE((*buffer)[1023] == 'x');
+    }
 }
 
 struct Data {
@@ -467,3 +486,285 @@ TEST_CASE("Destructor for correct type") {
         REQUIRE(B::destructor_called);
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct AllocatorStats {
+    size_t allocated = 0;
+    size_t deallocated = 0;
+};
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    CountingAllocator(AllocatorStats* stats) : stats(stats) {
+    }
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : stats(other.stats) {
+    }
+
+    T* allocate(size_t n) {
+        stats->allocated += n * sizeof(T);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        stats->deallocated += n * sizeof(T);
+        ::operator delete(ptr);
+    }
+
+    AllocatorStats* stats;
+};
+
+template <typename T>
+struct BufferAllocator {
+    using value_type = T;
+
+    BufferAllocator(char* buffer) : buffer(buffer) {
+    }
+
+    template <typename U>
+    BufferAllocator(const BufferAllocator<U>& other) : buffer(other.buffer) {
+    }
+
+    T* allocate(size_t) {
+        return reinterpret_cast<T*>(buffer);
+    }
+
+    void deallocate(T*, size_t) {
+    }
+
+    char* buffer;
+};
+
+template <typename T>
+struct EmptyAllocator : std::allocator<T> {
+    EmptyAllocator() = default;
+
+    template <typename U>
+    EmptyAllocator(const EmptyAllocator<U>&) {
+    }
+
+    template <typename U>
+    struct rebind {
+        using other = EmptyAllocator<U>;
+    };
+};
+
+TEST_CASE("AllocateShared") {
+    SECTION("Block goes through the allocator") {
+        AllocatorStats stats;
+        {
+            auto sp = AllocateShared<std::string>(CountingAllocator<char>(&stats), "allocated");
+            REQUIRE(*sp == "allocated");
+            REQUIRE(stats.allocated > sizeof(std::string));
+            REQUIRE(stats.deallocated == 0);
+        }
+        REQUIRE(stats.allocated == stats.deallocated);
+    }
+
+    SECTION("No global allocations") {
+        alignas(std::max_align_t) char buffer[64];
+        BufferAllocator<int> alloc(buffer);
+        EXPECT_ZERO_ALLOCATIONS(REQUIRE(*AllocateShared<int>(alloc, 42) == 42));
+    }
+
+    SECTION("Empty allocator takes no space") {
+        using Block = ControlBlockObjectAllocator<int, EmptyAllocator<int>, SingleThreadedCounter>;
+        REQUIRE(sizeof(Block) == sizeof(ControlBlockObject<int, SingleThreadedCounter>));
+    }
+
+    SECTION("Faulty constructor") {
+        AllocatorStats stats;
+        REQUIRE_THROWS(AllocateShared<Throwing>(CountingAllocator<Throwing>(&stats)));
+        REQUIRE(stats.allocated == stats.deallocated);
+    }
+
+    SECTION("Type conversions") {
+        B::destructor_called = false;
+        AllocatorStats stats;
+        { SharedPtr<A> ptr = AllocateShared<B>(CountingAllocator<B>(&stats)); }
+        REQUIRE(B::destructor_called);
+        REQUIRE(stats.allocated == stats.deallocated);
+    }
+}
+
+TEST_CASE("Deleter and allocator") {
+    SECTION("Custom deleter") {
+        int deleted = 0;
+        {
+            SharedPtr<int> sp(new int(42), [&deleted](int* ptr) {
+                ++deleted;
+                delete ptr;
+            });
+            SharedPtr<int> copy = sp;
+            REQUIRE(*copy == 42);
+        }
+        REQUIRE(deleted == 1);
+    }
+
+    SECTION("Block goes through the allocator") {
+        AllocatorStats stats;
+        {
+            SharedPtr<int> sp(new int(42), [](int* ptr) { delete ptr; },
+                              CountingAllocator<int>(&stats));
+            REQUIRE(stats.allocated > 0);
+            sp.Reset(new int(43), [](int* ptr) { delete ptr; }, CountingAllocator<int>(&stats));
+            REQUIRE(*sp == 43);
+        }
+        REQUIRE(stats.allocated == stats.deallocated);
+    }
+
+    SECTION("Empty deleter and allocator take no space") {
+        struct EmptyDeleter {
+            void operator()(int* ptr) const {
+                delete ptr;
+            }
+        };
+        REQUIRE(sizeof(ControlBlockPtrAllocator<int, EmptyDeleter, EmptyAllocator<int>,
+                                                SingleThreadedCounter>) ==
+                sizeof(ControlBlockPtr<int, SingleThreadedCounter>));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Element {
+    inline static int alive = 0;
+    inline static int throw_after = -1;
+
+    int value = 7;
+
+    Element() {
+        if (throw_after == 0) {
+            throw 42;
+        }
+        --throw_after;
+        ++alive;
+    }
+
+    Element(const Element& other) : Element() {
+        value = other.value;
+    }
+
+    ~Element() {
+        --alive;
+    }
+};
+
+TEST_CASE("Arrays") {
+    SECTION("Owns new[]") {
+        {
+            SharedPtr<Element[]> sp(new Element[3]);
+            SharedPtr<Element[]> copy = sp;
+            REQUIRE(Element::alive == 3);
+            REQUIRE(copy[2].value == 7);
+            sp.Reset(new Element[2]);
+            REQUIRE(Element::alive == 5);
+        }
+        REQUIRE(Element::alive == 0);
+    }
+
+    SECTION("MakeShared for unbounded arrays") {
+        auto sp = MakeShared<int[]>(5);
+        for (int i = 0; i < 5; ++i) {
+            REQUIRE(sp[i] == 0);
+        }
+        sp[3] = 42;
+        REQUIRE(sp.Get()[3] == 42);
+
+        auto filled = MakeShared<int[]>(4, 17);
+        REQUIRE(filled[0] == 17);
+        REQUIRE(filled[3] == 17);
+
+        REQUIRE(MakeShared<int[]>(0).UseCount() == 1);
+    }
+
+    SECTION("MakeShared for bounded arrays") {
+        {
+            auto sp = MakeShared<Element[4]>();
+            REQUIRE(Element::alive == 4);
+            Element init;
+            init.value = 9;
+            auto filled = MakeShared<Element[2]>(init);
+            REQUIRE(filled[1].value == 9);
+        }
+        REQUIRE(Element::alive == 0);
+    }
+
+    SECTION("One allocation") {
+        EXPECT_ONE_ALLOCATION(MakeShared<int[]>(1000));
+        MakeShared<int[]>(4);
+        EXPECT_ZERO_ALLOCATIONS(MakeShared<int[]>(4));
+    }
+
+    SECTION("Over-aligned elements") {
+        struct alignas(64) Aligned {
+            char data[64];
+        };
+        auto sp = MakeShared<Aligned[]>(3);
+        for (int i = 0; i < 3; ++i) {
+            REQUIRE(reinterpret_cast<uintptr_t>(&sp[i]) % 64 == 0);
+        }
+    }
+
+    SECTION("Faulty element constructor") {
+        Element::throw_after = 2;
+        REQUIRE_THROWS(MakeShared<Element[]>(5));
+        Element::throw_after = -1;
+        REQUIRE(Element::alive == 0);
+    }
+
+    SECTION("MakeSharedForOverwrite") {
+        {
+            auto sp = MakeSharedForOverwrite<Element[]>(3);
+            REQUIRE(Element::alive == 3);
+            REQUIRE(sp[2].value == 7);
+            auto bounded = MakeSharedForOverwrite<Element[2]>();
+            REQUIRE(Element::alive == 5);
+        }
+        REQUIRE(Element::alive == 0);
+
+        auto buffer = MakeSharedForOverwrite<char[]>(1 << 20);
+        buffer[(1 << 20) - 1] = 'x';
+        REQUIRE(buffer[(1 << 20) - 1] == 'x');
+        EXPECT_ONE_ALLOCATION(MakeSharedForOverwrite<char[]>(32 << 10));
+    }
+
+    SECTION("Aliasing an element") {
+        auto sp = MakeShared<int[]>(3, 1);
+        SharedPtr<int> element(sp, &sp[1]);
+        sp.Reset();
+        REQUIRE(*element == 1);
+        REQUIRE(element.UseCount() == 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct ChainNode {
+    SharedPtr<ChainNode> next;
+};
+
+TEST_CASE("Long chains") {
+    SECTION("Destroyed without recursion") {
+        SharedPtr<ChainNode> head;
+        for (int i = 0; i < 1'000'000; ++i) {
+            auto node = MakeShared<ChainNode>();
+            node->next = std::move(head);
+            head = std::move(node);
+        }
+        head.Reset();
+    }
+
+    SECTION("Shared tail stays alive") {
+        auto tail = MakeShared<ChainNode>();
+        auto head = MakeShared<ChainNode>();
+        head->next = MakeShared<ChainNode>();
+        head->next->next = tail;
+        head.Reset();
+        REQUIRE(tail.UseCount() == 1);
+    }
+}
@@ -0,0 +1,116 @@
+#include <intrusive/intrusive_weak.h>
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+#include <catch.hpp>
+
+#include <common/my_int.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Built with `SMART_PTRS_STATS`. The counters are global, so every test compares snapshots taken
+// before and after.
+
+static_assert(kSmartPtrStatsEnabled);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+SmartPtrStats Delta(const SmartPtrStats& before) {
+    return GetSmartPtrStats() - before;
+}
+
+struct Node : WeakRefCounted<Node, SimpleCounter> {
+    int value = 0;
+};
+
+struct Throwing {
+    Throwing() {
+        throw 42;
+    }
+};
+}  // namespace
+
+TEST_CASE("Control blocks") {
+    SmartPtrStats before = GetSmartPtrStats();
+    auto made = MakeShared<MyInt>(1);
+    SharedPtr<MyInt> adopted(new MyInt(2));
+    WeakPtr<MyInt> weak(made);
+
+    SmartPtrStats delta = Delta(before);
+    REQUIRE(delta.control_blocks_allocated == 2);
+    REQUIRE(delta.LiveObjects() == 2);
+    REQUIRE(delta.ObjectBlockBytes() > sizeof(MyInt));
+
+    made.Reset();
+    delta = Delta(before);
+    REQUIRE(delta.LiveObjects() == 1);
+    REQUIRE(delta.WeakOnlyBlocks() == 1);
+    REQUIRE(delta.ObjectBlockBytes() > 0);
+
+    weak.Reset();
+    adopted.Reset();
+    delta = Delta(before);
+    REQUIRE(delta.control_blocks_freed == 2);
+    REQUIRE(delta.LiveObjects() == 0);
+    REQUIRE(delta.WeakOnlyBlocks() == 0);
+    REQUIRE(delta.ObjectBlockBytes() == 0);
+}
+
+TEST_CASE("Failed construction") {
+    SmartPtrStats before = GetSmartPtrStats();
+    REQUIRE_THROWS(MakeShared<Throwing>());
+    REQUIRE_THROWS(AllocateShared<Throwing>(std::allocator<Throwing>()));
+    SmartPtrStats delta = Delta(before);
+    REQUIRE(delta.control_blocks_allocated == delta.control_blocks_freed);
+    REQUIRE(delta.LiveObjects() == 0);
+    REQUIRE(delta.WeakOnlyBlocks() == 0);
+    REQUIRE(delta.ObjectBlockBytes() == 0);
+}
+
+TEST_CASE("Lock") {
+    SmartPtrStats before = GetSmartPtrStats();
+    auto sp = MakeShared<int>(1);
+    WeakPtr<int> weak(sp);
+    REQUIRE(weak.Lock());
+    sp.Reset();
+    REQUIRE(!weak.Lock());
+    REQUIRE(!WeakPtr<int>().Lock());
+
+    IntrusivePtr<Node> node(new Node());
+    IntrusiveWeakPtr<Node> intrusive_weak(node);
+    REQUIRE(intrusive_weak.Lock());
+    node.Reset();
+    REQUIRE(!intrusive_weak.Lock());
+
+    SmartPtrStats delta = Delta(before);
+    REQUIRE(delta.lock_succeeded == 2);
+    REQUIRE(delta.lock_failed == 3);
+    REQUIRE(delta.intrusive_destroyed == 1);
+}
+
+TEST_CASE("Many threads") {
+    constexpr int kNumThreads = 4;
+    constexpr int kNumIters = 1000;
+    SmartPtrStats before = GetSmartPtrStats();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([] {
+            for (int j = 0; j < kNumIters; ++j) {
+                auto sp = MakeShared<int, AtomicCounter>(j);
+                WeakPtr<int, AtomicCounter> weak(sp);
+                weak.Lock();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    // The shards of the exited threads still count.
+    SmartPtrStats delta = Delta(before);
+    REQUIRE(delta.control_blocks_allocated == kNumThreads * kNumIters);
+    REQUIRE(delta.control_blocks_freed == kNumThreads * kNumIters);
+    REQUIRE(delta.lock_succeeded == kNumThreads * kNumIters);
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "unique.h"
+
+#include <common/destruction_worklist.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename T>
+struct ArenaDeleter;
+
+// Monotonic arena for objects that die together, such as the nodes of a per-request parse tree.
+//
+//     MonotonicArena arena;
+//     UniquePtr<Node, ArenaDeleter<Node>> root = MakeUniqueIn<Node>(arena, args...);
+//
+// Allocation bumps a pointer through 64 KiB chunks. Releasing a pointer only runs the destructor:
+// the memory stays with the arena until `Release()` or the destructor of the arena frees all
+// chunks at once. The chunks are aligned to their size, so the deleter finds the arena from the
+// header at the aligned start of the chunk and carries no state: `UniquePtr<T, ArenaDeleter<T>>`
+// is one pointer.
+//
+// Not thread-safe. All objects must be destroyed before their memory is released.
+class MonotonicArena {
+public:
+    static constexpr size_t kChunkSize = 64 * 1024;
+    static constexpr size_t kMaxAlignment = 4096;
+
+    MonotonicArena() = default;
+
+    MonotonicArena(const MonotonicArena&) = delete;
+    MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+    ~MonotonicArena() {
+        Release();
+    }
+
+    // Objects larger than a chunk get a chunk of their own.
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        assert(alignment <= kMaxAlignment && (alignment & (alignment - 1)) == 0);
+        char* begin = AlignUp(bump_, alignment);
+        // Strictly inside the chunk, so that even an empty array maps back to its chunk.
+        if (begin == nullptr || begin + size >= end_) [[unlikely]] {
+            return AllocateChunk(size, alignment);
+        }
+        bump_ = begin + size;
+        return begin;
+    }
+
+    // Frees every chunk at once.
+    void Release() {
+        assert(num_live_ == 0 && "arena released before its objects");
+        while (chunks_ != nullptr) {
+            Chunk* next = chunks_->next;
+            std::free(chunks_);
+            chunks_ = next;
+        }
+        bump_ = nullptr;
+        end_ = nullptr;
+    }
+
+    // Objects created with `MakeUniqueIn` and not destroyed yet.
+    size_t NumLive() const {
+        return num_live_;
+    }
+
+    size_t NumChunks() const {
+        size_t count = 0;
+        for (Chunk* chunk = chunks_; chunk != nullptr; chunk = chunk->next) {
+            ++count;
+        }
+        return count;
+    }
+
+    // The arena that allocated `ptr`. Valid for pointers into the first `kChunkSize` bytes of an
+    // allocation, which covers objects and their base subobjects unless they are huge.
+    static MonotonicArena& Of(const void* ptr) {
+        auto address = reinterpret_cast<uintptr_t>(ptr);
+        return *reinterpret_cast<Chunk*>(address & ~(kChunkSize - 1))->arena;
+    }
+
+private:
+    struct alignas(std::max_align_t) Chunk {
+        MonotonicArena* arena;
+        Chunk* next;
+    };
+
+    Chunk* chunks_ = nullptr;
+    char* bump_ = nullptr;
+    char* end_ = nullptr;
+    size_t num_live_ = 0;
+
+    template <typename T>
+    friend struct ArenaDeleter;
+
+    template <typename T, typename... Args>
+        requires(!std::is_array_v<T>)
+    friend UniquePtr<T, ArenaDeleter<T>> MakeUniqueIn(MonotonicArena& arena, Args&&... args);
+
+    template <typename T>
+        requires std::is_unbounded_array_v<T>
+    friend UniquePtr<T, ArenaDeleter<T>> MakeUniqueIn(MonotonicArena& arena, size_t size);
+
+    static char* AlignUp(char* ptr, size_t alignment) {
+        auto address = reinterpret_cast<uintptr_t>(ptr);
+        return reinterpret_cast<char*>((address + alignment - 1) & ~(alignment - 1));
+    }
+
+    void* AllocateChunk(size_t size, size_t alignment) {
+        size_t needed = sizeof(Chunk) + alignment + size;
+        size_t bytes = (needed + kChunkSize - 1) / kChunkSize * kChunkSize;
+        void* memory = std::aligned_alloc(kChunkSize, bytes);
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        auto* chunk = ::new (memory) Chunk{this, chunks_};
+        chunks_ = chunk;
+        char* begin = AlignUp(reinterpret_cast<char*>(chunk + 1), alignment);
+        // A chunk of its own for a large object; the current chunk keeps serving small ones.
+        if (bytes == kChunkSize) {
+            bump_ = begin + size;
+            end_ = static_cast<char*>(memory) + kChunkSize;
+        }
+        return begin;
+    }
+};
+
+// Runs the destructor and leaves the memory to the arena. Like `DefaultDeleter`, destruction
+// goes through `DestructionWorklist`, so deep trees are destroyed in constant stack.
+template <typename T>
+struct ArenaDeleter {
+    ArenaDeleter() = default;
+
+    template <class F>
+    ArenaDeleter(ArenaDeleter<F>&&) noexcept {
+    }
+
+    void operator()(T* ptr) const {
+        static_assert(sizeof(T) > 0);
+        DestructionWorklist::Run(const_cast<std::remove_cv_t<T>*>(ptr), [](void* object) {
+            auto* typed = static_cast<T*>(object);
+            MonotonicArena& arena = MonotonicArena::Of(typed);
+            std::destroy_at(typed);
+            --arena.num_live_;
+        });
+    }
+};
+
+// Arrays keep their length in front of the first element.
+template <typename T>
+struct ArenaDeleter<T[]> {
+    ArenaDeleter() = default;
+
+    void operator()(T* ptr) const {
+        static_assert(sizeof(T) > 0);
+        DestructionWorklist::Run(const_cast<std::remove_cv_t<T>*>(ptr), [](void* object) {
+            auto* typed = static_cast<T*>(object);
+            MonotonicArena& arena = MonotonicArena::Of(typed);
+            std::destroy_n(typed, *(reinterpret_cast<size_t*>(typed) - 1));
+            --arena.num_live_;
+        });
+    }
+};
+
+template <typename T, typename... Args>
+    requires(!std::is_array_v<T>)
+UniquePtr<T, ArenaDeleter<T>> MakeUniqueIn(MonotonicArena& arena, Args&&... args) {
+    static_assert(alignof(T) <= MonotonicArena::kMaxAlignment);
+    void* memory = arena.Allocate(sizeof(T), alignof(T));
+    T* object = ::new (memory) T(std::forward<Args>(args)...);
+    ++arena.num_live_;
+    return UniquePtr<T, ArenaDeleter<T>>(object);
+}
+
+// `MakeUniqueIn<T[]>(arena, n)`: `n` value-initialized elements.
+template <typename T>
+    requires std::is_unbounded_array_v<T>
+UniquePtr<T, ArenaDeleter<T>> MakeUniqueIn(MonotonicArena& arena, size_t size) {
+    using Element = std::remove_extent_t<T>;
+    static_assert(alignof(Element) <= MonotonicArena::kMaxAlignment);
+    constexpr size_t kAlignment = std::max(alignof(Element), alignof(size_t));
+    constexpr size_t kPrefix = (sizeof(size_t) + kAlignment - 1) / kAlignment * kAlignment;
+    size_t bytes = kPrefix + size * sizeof(Element);
+    auto* memory = static_cast<char*>(arena.Allocate(bytes, kAlignment));
+    auto* elements = reinterpret_cast<Element*>(memory + kPrefix);
+    std::uninitialized_value_construct_n(elements, size);
+    *(reinterpret_cast<size_t*>(elements) - 1) = size;
+    ++arena.num_live_;
+    return UniquePtr<T, ArenaDeleter<T>>(elements);
+}
@@ -1,4 +1,5 @@
 #include "unique.h"
+#include "arena.h"
 
 #include "deleters.h"
 #include "compressed_pair.h"
@@ -8,6 +9,7 @@
 #include <catch.hpp>
 #include <vector>
 #include <tuple>
+#include <string>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -505,3 +507,141 @@ TEST_CASE("Upcasts") {
         s2 = std::move(s);
     }
 }
+
+TEST_CASE("MakeUniqueForOverwrite") {
+    SECTION("Object") {
+        {
+            auto ptr = MakeUniqueForOverwrite<MyInt>();
+            REQUIRE(MyInt::AliveCount() == 1);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Array") {
+        {
+            auto buffer = MakeUniqueForOverwrite<MyInt[]>(3);
+            REQUIRE(MyInt::AliveCount() == 3);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+
+        auto bytes = MakeUniqueForOverwrite<char[]>(1 << 20);
+        bytes[(1 << 20) - 1] = 'x';
+        REQUIRE(bytes[(1 << 20) - 1] == 'x');
+    }
+}
+
+struct ChainNode {
+    UniquePtr<ChainNode> next;
+};
+
+TEST_CASE("Long chains") {
+    UniquePtr<ChainNode> head;
+    for (int i = 0; i < 1'000'000; ++i) {
+        UniquePtr<ChainNode> node(new ChainNode);
+        node->next = std::move(head);
+        head = std::move(node);
+    }
+    head.Reset();
+    REQUIRE(head.Get() == nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct ParseNode {
+    explicit ParseNode(std::string token) : token(std::move(token)) {
+    }
+
+    std::string token;
+    UniquePtr<ParseNode, ArenaDeleter<ParseNode>> left;
+    UniquePtr<ParseNode, ArenaDeleter<ParseNode>> right;
+};
+
+struct alignas(256) Aligned {
+    char byte = 0;
+};
+
+TEST_CASE("Arena") {
+    static_assert(sizeof(UniquePtr<ParseNode, ArenaDeleter<ParseNode>>) == sizeof(ParseNode*));
+    static_assert(sizeof(UniquePtr<MyInt[], ArenaDeleter<MyInt[]>>) == sizeof(MyInt*));
+
+    SECTION("Objects") {
+        MonotonicArena arena;
+        {
+            auto first = MakeUniqueIn<MyInt>(arena, 1);
+            auto second = MakeUniqueIn<MyInt>(arena, 2);
+            REQUIRE(*first == 1);
+            REQUIRE(*second == 2);
+            REQUIRE(MyInt::AliveCount() == 2);
+            REQUIRE(arena.NumLive() == 2);
+            REQUIRE(&MonotonicArena::Of(second.Get()) == &arena);
+            first.Reset();
+            REQUIRE(MyInt::AliveCount() == 1);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+        REQUIRE(arena.NumLive() == 0);
+        REQUIRE(arena.NumChunks() == 1);
+        arena.Release();
+        REQUIRE(arena.NumChunks() == 0);
+    }
+
+    SECTION("Trees") {
+        MonotonicArena arena;
+        auto root = MakeUniqueIn<ParseNode>(arena, "+");
+        root->left = MakeUniqueIn<ParseNode>(arena, "1");
+        root->right = MakeUniqueIn<ParseNode>(arena, "*");
+        root->right->left = MakeUniqueIn<ParseNode>(arena, "2");
+        REQUIRE(root->right->left->token == "2");
+        REQUIRE(arena.NumLive() == 4);
+        root.Reset();
+        REQUIRE(arena.NumLive() == 0);
+    }
+
+    SECTION("Long chains") {
+        MonotonicArena arena;
+        auto head = MakeUniqueIn<ParseNode>(arena, "");
+        for (int i = 0; i < 1'000'000; ++i) {
+            auto node = MakeUniqueIn<ParseNode>(arena, "");
+            node->left = std::move(head);
+            head = std::move(node);
+        }
+        REQUIRE(arena.NumChunks() > 1);
+        REQUIRE(&MonotonicArena::Of(head->left.Get()) == &arena);
+        head.Reset();
+        REQUIRE(arena.NumLive() == 0);
+    }
+
+    SECTION("Arrays") {
+        MonotonicArena arena;
+        {
+            auto ints = MakeUniqueIn<MyInt[]>(arena, 5);
+            REQUIRE(MyInt::AliveCount() == 5);
+            auto chars = MakeUniqueIn<char[]>(arena, 3);
+            REQUIRE(chars[2] == 0);
+            auto empty = MakeUniqueIn<MyInt[]>(arena, 0);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+        REQUIRE(arena.NumLive() == 0);
+    }
+
+    SECTION("Alignment and large objects") {
+        MonotonicArena arena;
+        auto small = MakeUniqueIn<char>(arena, 'a');
+        auto aligned = MakeUniqueIn<Aligned>(arena);
+        REQUIRE(reinterpret_cast<uintptr_t>(aligned.Get()) % 256 == 0);
+        auto large = MakeUniqueIn<char[]>(arena, 3 * MonotonicArena::kChunkSize);
+        large[3 * MonotonicArena::kChunkSize - 1] = 'z';
+        REQUIRE(arena.NumChunks() == 2);
+        auto next = MakeUniqueIn<char>(arena, 'b');
+        REQUIRE(arena.NumChunks() == 2);
+        REQUIRE(&MonotonicArena::Of(next.Get()) == &MonotonicArena::Of(small.Get()));
+    }
+
+    SECTION("Upcasts") {
+        MonotonicArena arena;
+        UniquePtr<Person, ArenaDeleter<Person>> person = MakeUniqueIn<Alice>(arena);
+        REQUIRE(person->GetFavoriteNumber() == 37);
+        person = MakeUniqueIn<Bob>(arena);
+        REQUIRE(person->GetFavoriteNumber() == 43);
+        REQUIRE(arena.NumLive() == 1);
+    }
+}
@@ -3,7 +3,10 @@
 #include "compressed_pair.h"
 #include "deleters.h"
 
+#include <common/destruction_worklist.h>
+
 #include <cstddef>  // std::nullptr_t
+#include <type_traits>
 
 template <typename T>
 struct DefaultDeleter {
@@ -15,10 +18,13 @@ struct DefaultDeleter {
 
     ~DefaultDeleter() = default;
 
+    // Deletions from inside destructors are queued by `DestructionWorklist`, so long chains of
+    // `UniquePtr`s are destroyed in constant stack.
     void operator()(T* ptr) const {
         static_assert(sizeof(T) > 0);
         static_assert(!std::is_void<T>::value);
-        delete ptr;
+        DestructionWorklist::Run(const_cast<std::remove_cv_t<T>*>(ptr),
+                                 [](void* object) { delete static_cast<T*>(object); });
     }
 };
 
@@ -131,7 +137,8 @@ struct DefaultDeleter<T[]> {
     void operator()(T* ptr) const {
         static_assert(sizeof(T) > 0);
         static_assert(!std::is_void<T>::value);
-        delete[] ptr;
+        DestructionWorklist::Run(const_cast<std::remove_cv_t<T>*>(ptr),
+                                 [](void* object) { delete[] static_cast<T*>(object); });
     }
 };
 
@@ -238,3 +245,16 @@ public:
 private:
     CompressedPair<T*, Deleter> data_;
 };
+
+// Default-initialized object or array: no zeroing of buffers that are about to be overwritten.
+template <typename T>
+    requires(!std::is_array_v<T>)
+UniquePtr<T> MakeUniqueForOverwrite() {
+    return UniquePtr<T>(new T);
+}
+
+template <typename T>
+    requires std::is_unbounded_array_v<T>
+UniquePtr<T> MakeUniqueForOverwrite(size_t size) {
+    return UniquePtr<T>(new std::remove_extent_t<T>[size]);
+}
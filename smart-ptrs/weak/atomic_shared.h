@@ -0,0 +1,173 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstdint>
+
+// A `SharedPtr<T, AtomicCounter>` that can be loaded and replaced from many threads at once.
+// Every operation is lock-free: a load is a single `fetch_add` on one 64-bit word.
+//
+// The stored pointer lives in a holder: a control block whose object is the `SharedPtr` itself.
+// `Load` returns an aliasing pointer that shares ownership of the holder, so the holder pointer
+// fits into the word together with a 16-bit count of the references handed out by loads (split
+// reference counting). Those references are paid for in advance: the holder is stored with
+// `kPrefunded` shared references, a load takes one of them just by incrementing the count, and
+// whoever replaces the holder gives back the ones nobody took. Once half of them are gone, a
+// loader moves more into the holder.
+//
+// While a holder is stored, `UseCount()` of loaded pointers includes the prepaid references.
+//
+// Relies on user-space pointers fitting into 48 bits, as they do on x86-64 and AArch64 Linux.
+template <typename T>
+class AtomicSharedPtr {
+    using Pointer = SharedPtr<T, AtomicCounter>;
+    using Holder = ControlBlockObject<Pointer, AtomicCounter>;
+
+public:
+    AtomicSharedPtr() = default;
+
+    AtomicSharedPtr(Pointer desired) {
+        word_.store(Pack(MakeHolder(std::move(desired))), std::memory_order_relaxed);
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ~AtomicSharedPtr() {
+        Release(word_.load(std::memory_order_relaxed));
+    }
+
+    Pointer Load() const {
+        uint64_t word = word_.fetch_add(kOneLoad, std::memory_order_acquire);
+        Holder* holder = Unpack(word);
+        if (holder == nullptr) {
+            return Pointer();
+        }
+        if (Loads(word) + 1 >= kRefillAt) {
+            Refill(holder);
+        }
+        return Adopt(holder);
+    }
+
+    void Store(Pointer desired) {
+        Release(word_.exchange(Pack(MakeHolder(std::move(desired))), std::memory_order_acq_rel));
+    }
+
+    Pointer Exchange(Pointer desired) {
+        uint64_t word =
+            word_.exchange(Pack(MakeHolder(std::move(desired))), std::memory_order_acq_rel);
+        Holder* holder = Unpack(word);
+        if (holder == nullptr) {
+            return Pointer();
+        }
+        // One of the references left in the word goes to the result.
+        uint64_t unused = kPrefunded - Loads(word) - 1;
+        if (unused > 0) {
+            holder->DecreaseSharedCounter(unused);
+        }
+        return Adopt(holder);
+    }
+
+    // Stores `desired` if the current value is `expected`: the same holder (a pointer obtained
+    // from `Load`) or the same object and control block. Otherwise loads the current value into
+    // `expected`. Never fails spuriously.
+    bool CompareExchange(Pointer& expected, Pointer desired) {
+        Holder* replacement = nullptr;
+        while (true) {
+            Pointer current = Load();
+            if (!Equivalent(current, expected)) {
+                if (replacement != nullptr) {
+                    replacement->DecreaseSharedCounter(kPrefunded);
+                }
+                expected = std::move(current);
+                return false;
+            }
+            if (replacement == nullptr && desired) {
+                replacement = MakeHolder(std::move(desired));
+            }
+            // `current` keeps its holder alive, so the holder address cannot be reused meanwhile.
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            while (Unpack(word) == current.control_block_) {
+                if (word_.compare_exchange_weak(word, Pack(replacement), std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                    Release(word);
+                    return true;
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr int kPointerBits = 48;
+    static constexpr uint64_t kPointerMask = (uint64_t{1} << kPointerBits) - 1;
+    static constexpr uint64_t kOneLoad = uint64_t{1} << kPointerBits;
+    static constexpr uint64_t kPrefunded = uint64_t{1} << 15;
+    static constexpr uint64_t kRefillAt = kPrefunded / 2;
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+    mutable std::atomic<uint64_t> word_ = 0;
+
+    static uint64_t Pack(Holder* holder) {
+        return reinterpret_cast<uintptr_t>(holder);
+    }
+
+    static Holder* Unpack(uint64_t word) {
+        return reinterpret_cast<Holder*>(static_cast<uintptr_t>(word & kPointerMask));
+    }
+
+    static uint64_t Loads(uint64_t word) {
+        return word >> kPointerBits;
+    }
+
+    static Holder* MakeHolder(Pointer&& desired) {
+        if (!desired) {
+            return nullptr;
+        }
+        auto* holder = new Holder(std::move(desired));
+        holder->IncreaseSharedCounter(kPrefunded - 1);
+        return holder;
+    }
+
+    // Turns one of the references taken through the word into a pointer to the stored object.
+    static Pointer Adopt(Holder* holder) {
+        Pointer result;
+        result.control_block_ = holder;
+        result.ptr_ = holder->GetPointer()->Get();
+        return result;
+    }
+
+    // Gives back the references the word still holds on a holder that has been replaced.
+    static void Release(uint64_t word) {
+        if (Holder* holder = Unpack(word)) {
+            holder->DecreaseSharedCounter(kPrefunded - Loads(word));
+        }
+    }
+
+    // Moves `kRefillAt` references into the holder and takes them off the load count. If the
+    // holder has been replaced meanwhile, the replacing thread has already settled the count and
+    // the references go back. The caller holds a reference, so the holder stays alive.
+    void Refill(Holder* holder) const {
+        holder->IncreaseSharedCounter(kRefillAt);
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        while (Unpack(word) == holder && Loads(word) >= kRefillAt) {
+            if (word_.compare_exchange_weak(word, word - kRefillAt * kOneLoad,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        holder->DecreaseSharedCounter(kRefillAt);
+    }
+
+    static bool Equivalent(const Pointer& current, const Pointer& expected) {
+        if (current.control_block_ == expected.control_block_) {
+            return true;
+        }
+        if (current.control_block_ == nullptr) {
+            return false;
+        }
+        const Pointer& stored = *static_cast<Holder*>(current.control_block_)->GetPointer();
+        return stored.control_block_ == expected.control_block_ && stored.Get() == expected.Get();
+    }
+};
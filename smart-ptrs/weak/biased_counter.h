@@ -0,0 +1,238 @@
+#pragma once
+
+#include "sw_fwd.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Biased reference counting (Choi, Shull, Torrellas, PACT'18), the scheme CPython uses for
+// free-threading.
+//
+// The thread that creates a block owns it and counts its references in `local_` with plain
+// loads/stores. Every other thread counts in the atomic `shared_` word, which may go negative.
+// The two halves are merged, and the block becomes an ordinary atomic counter, when
+//  * the owner drops its local count to zero, or
+//  * another thread is about to drop `shared_` below zero: that reference is handed over to the
+//    owner's queue, and the owner merges the block on its next release or in `MergeQueued()`.
+//    If the owner has already exited, the releasing thread merges the block itself.
+//
+// Use as `SharedPtr<T, BiasedCounter>`.
+class BiasedCounter {
+public:
+    BiasedCounter() {
+        size_t id = Thread::Current().id;
+        if (id == kExitedThread) {
+            // Created during thread exit: there is nobody to merge for, start merged.
+            local_.store(0, std::memory_order_relaxed);
+            shared_.store(kOne | kMerged, std::memory_order_relaxed);
+            id = 0;
+        }
+        owner_.store(id, std::memory_order_relaxed);
+    }
+
+    void IncreaseShared(uint64_t count = 1) {
+        if (IsOwner()) {
+            local_.store(local_.load(std::memory_order_relaxed) + count,
+                         std::memory_order_relaxed);
+        } else {
+            shared_.fetch_add(kOne * static_cast<int64_t>(count), std::memory_order_relaxed);
+        }
+    }
+
+    bool DecreaseShared() {
+        if (!IsOwner()) {
+            return DecreaseSharedSlow();
+        }
+        size_t local = local_.load(std::memory_order_relaxed) - 1;
+        local_.store(local, std::memory_order_relaxed);
+        if (local == 0) {
+            return MergeZeroLocal();
+        }
+        if (Thread::Current().has_queued.load(std::memory_order_relaxed)) {
+            MergeQueued();
+        }
+        return false;
+    }
+
+    bool TryIncreaseShared() {
+        if (IsOwner()) {
+            // The owner still holds a local reference, so the block cannot have expired.
+            IncreaseShared();
+            return true;
+        }
+        int64_t shared = shared_.load(std::memory_order_relaxed);
+        do {
+            if (shared == kMerged) {
+                return false;
+            }
+        } while (!shared_.compare_exchange_weak(shared, shared + kOne, std::memory_order_relaxed));
+        return true;
+    }
+
+    void IncreaseWeak() {
+        weak_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool DecreaseWeak() {
+        return weak_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    size_t GetShared() const {
+        // A queued block has one reference parked in the owner's queue.
+        int64_t shared = shared_.load(std::memory_order_relaxed);
+        int64_t count = static_cast<int64_t>(local_.load(std::memory_order_relaxed)) +
+                        (shared >> kShift) - (shared & kQueued);
+        return count > 0 ? count : 0;
+    }
+
+    size_t GetWeak() const {
+        return weak_.load(std::memory_order_relaxed) - (GetShared() > 0 ? 1 : 0);
+    }
+
+    // Merges the blocks other threads handed to the calling thread. Threads that own long-lived
+    // objects but rarely release anything may call this at convenient points.
+    static void MergeQueued();
+
+private:
+    // `shared_` keeps the count in the upper bits and two flags in the lower ones.
+    static constexpr int64_t kQueued = 1;
+    static constexpr int64_t kMerged = 2;
+    static constexpr int kShift = 2;
+    static constexpr int64_t kOne = 1 << kShift;
+
+    struct Thread {
+        size_t id;
+        std::atomic<bool> has_queued = false;
+        std::vector<BiasedCounter*> queue;
+
+        Thread();
+        ~Thread();
+
+        static Thread& Current() {
+            static thread_local Thread thread;
+            return thread;
+        }
+    };
+
+    // Owner ids are never reused, so a missing entry means that the owner has exited.
+    struct Registry {
+        std::mutex mutex;
+        std::unordered_map<size_t, Thread*> threads;
+        size_t next_id = 1;
+
+        static Registry& Instance() {
+            static Registry registry;
+            return registry;
+        }
+    };
+
+    // Thread id that never owns anything: used after the owner has been unregistered.
+    static constexpr size_t kExitedThread = SIZE_MAX;
+
+    std::atomic<size_t> owner_;
+    std::atomic<size_t> local_ = 1;
+    std::atomic<int64_t> shared_ = 0;
+    std::atomic<size_t> weak_ = 1;
+
+    bool IsOwner() const {
+        return owner_.load(std::memory_order_relaxed) == Thread::Current().id;
+    }
+
+    bool DecreaseSharedSlow() {
+        int64_t shared = shared_.load(std::memory_order_relaxed);
+        int64_t desired;
+        do {
+            // Dropping an unmerged count below zero: the reference goes to the owner's queue.
+            desired = shared == 0 ? kQueued : shared - kOne;
+        } while (!shared_.compare_exchange_weak(shared, desired, std::memory_order_acq_rel,
+                                                std::memory_order_relaxed));
+        if (shared == 0) {
+            return Enqueue();
+        }
+        return desired == kMerged;
+    }
+
+    // Called by the owner once its local count is zero; returns true if nothing is left.
+    bool MergeZeroLocal() {
+        owner_.store(0, std::memory_order_relaxed);
+        int64_t shared = shared_.load(std::memory_order_acquire);
+        while (!shared_.compare_exchange_weak(shared, (shared & ~(kQueued | kMerged)) | kMerged,
+                                              std::memory_order_acq_rel)) {
+        }
+        return shared >> kShift == 0;
+    }
+
+    // Merges both halves and drops the reference held by the queue.
+    bool MergeAndRelease() {
+        int64_t local = local_.load(std::memory_order_relaxed);
+        owner_.store(0, std::memory_order_relaxed);
+        local_.store(0, std::memory_order_relaxed);
+        int64_t shared = shared_.load(std::memory_order_acquire);
+        int64_t desired;
+        do {
+            desired = ((shared >> kShift) + local - 1) << kShift | kMerged;
+        } while (!shared_.compare_exchange_weak(shared, desired, std::memory_order_acq_rel));
+        return desired == kMerged;
+    }
+
+    bool Enqueue() {
+        {
+            Registry& registry = Registry::Instance();
+            std::lock_guard lock(registry.mutex);
+            auto it = registry.threads.find(owner_.load(std::memory_order_relaxed));
+            if (it != registry.threads.end()) {
+                it->second->queue.push_back(this);
+                it->second->has_queued.store(true, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        return MergeAndRelease();
+    }
+
+    static void Release(BiasedCounter* counter);
+};
+
+inline BiasedCounter::Thread::Thread() {
+    Registry& registry = Registry::Instance();
+    std::lock_guard lock(registry.mutex);
+    id = registry.next_id++;
+    registry.threads.emplace(id, this);
+}
+
+inline BiasedCounter::Thread::~Thread() {
+    std::vector<BiasedCounter*> orphans;
+    {
+        Registry& registry = Registry::Instance();
+        std::lock_guard lock(registry.mutex);
+        registry.threads.erase(id);
+        orphans.swap(queue);
+        // From now on this thread releases its own blocks through the shared path, and other
+        // threads merge them without waiting for it.
+        id = kExitedThread;
+    }
+    for (BiasedCounter* counter : orphans) {
+        Release(counter);
+    }
+}
+
+inline void BiasedCounter::MergeQueued() {
+    Thread& thread = Thread::Current();
+    std::vector<BiasedCounter*> queued;
+    {
+        std::lock_guard lock(Registry::Instance().mutex);
+        queued.swap(thread.queue);
+        thread.has_queued.store(false, std::memory_order_relaxed);
+    }
+    for (BiasedCounter* counter : queued) {
+        Release(counter);
+    }
+}
+
+inline void BiasedCounter::Release(BiasedCounter* counter) {
+    if (counter->MergeAndRelease()) {
+        static_cast<ControlBlock<BiasedCounter>*>(counter)->OnSharedExpired();
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "shared.h"
+
+// A non-owning view of a `SharedPtr`, for passing it down call chains without touching the
+// reference count. A callee that keeps the object calls `Promote` to get its own `SharedPtr`.
+//
+// A `Borrowed` must not outlive the object: some `SharedPtr` up the stack has to keep it alive.
+// Debug builds check this, and fail an assertion when a borrowed object is destroyed.
+//
+//     void Handle(Borrowed<Request> request) {
+//         Log(request->id);
+//         if (request->async) {
+//             queue.Push(request.Promote());
+//         }
+//     }
+template <typename T, typename Counter>
+class Borrowed {
+    template <typename Y, typename C>
+    friend class Borrowed;
+
+public:
+    using ElementType = std::remove_extent_t<T>;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    Borrowed(const SharedPtr<T, Counter>& source) {
+        control_block_ = source.control_block_;
+        ptr_ = source.ptr_;
+        Register();
+    }
+
+    template <typename Y>
+    Borrowed(const SharedPtr<Y, Counter>& source) {
+        control_block_ = source.control_block_;
+        ptr_ = source.ptr_;
+        Register();
+    }
+
+    template <typename Y>
+    Borrowed(const Borrowed<Y, Counter>& other) {
+        control_block_ = other.control_block_;
+        ptr_ = other.ptr_;
+        Register();
+    }
+
+    // Release builds keep the implicit copy and destructor: a trivially copyable `Borrowed` is
+    // passed in registers, like a raw pointer.
+#ifndef NDEBUG
+    Borrowed(const Borrowed& other) {
+        control_block_ = other.control_block_;
+        ptr_ = other.ptr_;
+        Register();
+    }
+
+    Borrowed& operator=(const Borrowed& other) {
+        if (this == &other) {
+            return *this;
+        }
+        Unregister();
+        control_block_ = other.control_block_;
+        ptr_ = other.ptr_;
+        Register();
+        return *this;
+    }
+
+    ~Borrowed() {
+        Unregister();
+    }
+#endif
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    ElementType* Get() const {
+        return ptr_;
+    }
+
+    ElementType& operator*() const {
+        return *ptr_;
+    }
+
+    ElementType* operator->() const {
+        return ptr_;
+    }
+
+    explicit operator bool() const {
+        return ptr_ != nullptr;
+    }
+
+    // Shares ownership of the borrowed object: one counter increment.
+    SharedPtr<T, Counter> Promote() const {
+        SharedPtr<T, Counter> promoted;
+        if (control_block_ != nullptr) {
+            control_block_->IncreaseSharedCounter();
+            promoted.control_block_ = control_block_;
+            promoted.ptr_ = ptr_;
+        }
+        return promoted;
+    }
+
+private:
+    ControlBlock<Counter>* control_block_;
+    ElementType* ptr_;
+
+    void Register() {
+#ifndef NDEBUG
+        if (control_block_ != nullptr) {
+            detail::BorrowRegistry::Add(control_block_);
+        }
+#endif
+    }
+
+    void Unregister() {
+#ifndef NDEBUG
+        if (control_block_ != nullptr) {
+            detail::BorrowRegistry::Remove(control_block_);
+        }
+#endif
+    }
+};
@@ -0,0 +1,344 @@
+#pragma once
+
+#include "shared.h"
+
+#include <common/destruction_worklist.h>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Synchronous cycle collection (Bacon and Rajan, "Concurrent Cycle Collection in Reference Counted
+// Systems", 2001) for graphs of `SharedPtr<T, CycleCollectedCounter>`.
+//
+//     struct Node {
+//         std::vector<SharedPtr<Node, CycleCollectedCounter>> edges;
+//
+//         void Trace(CycleTracer& tracer) const {
+//             for (const auto& edge : edges) {
+//                 tracer(edge);
+//             }
+//         }
+//     };
+//
+// A block whose count drops to a non-zero value may have just lost the last reference from outside
+// a cycle: it is buffered as a candidate root, once, with a weak reference. `Collect()` subtracts
+// the references between the objects reachable from the candidates; whatever is left with no
+// reference from outside is garbage and is destroyed. Cycles of garbage are never found otherwise,
+// so call it periodically, e.g. between requests.
+//
+// `Trace` must report every `SharedPtr` the object holds at most once. Unreported pointers only
+// keep their targets alive; made-up ones free live objects. Types without `Trace` are leaves and
+// are never buffered.
+//
+// Built on `SingleThreadedCounter`: candidates are buffered per thread, and objects of a graph
+// must stay on one thread. Each thread collects its own candidates once more when it exits.
+class CycleTracer;
+
+class CycleCollectedCounter : public SingleThreadedCounter {
+    friend class CycleCollector;
+    friend class CycleTracer;
+
+    using Block = ControlBlock<CycleCollectedCounter>;
+
+public:
+    void IncreaseShared(uint64_t count = 1) {
+        SingleThreadedCounter::IncreaseShared(count);
+        color_ = Color::kBlack;
+    }
+
+    bool DecreaseShared(uint64_t count = 1);
+
+    // Garbage being freed is already expired.
+    bool TryIncreaseShared() {
+        if (collecting_ || !SingleThreadedCounter::TryIncreaseShared()) {
+            return false;
+        }
+        color_ = Color::kBlack;
+        return true;
+    }
+
+    // Called by every new owner (see `SharedPtr::AdoptObject`) with the type it was given.
+    template <typename Y>
+    static void Adopt(Block* block, Y* object) {
+        if constexpr (requires(const Y& value, CycleTracer& tracer) { value.Trace(tracer); }) {
+            CycleCollectedCounter* counter = block;
+            counter->object_ = object;
+            counter->trace_ = [](const void* object, CycleTracer& tracer) {
+                static_cast<const Y*>(object)->Trace(tracer);
+            };
+        }
+    }
+
+private:
+    enum class Color : uint8_t {
+        kBlack,   // In use, or not looked at
+        kGray,    // Possible member of a garbage cycle
+        kWhite,   // Garbage
+        kPurple,  // Candidate root
+    };
+
+    using TraceFunction = void (*)(const void*, CycleTracer&);
+
+    const void* object_ = nullptr;
+    TraceFunction trace_ = nullptr;
+    size_t trial_ = 0;  // References from outside the traced subgraph
+    Color color_ = Color::kBlack;
+    bool buffered_ = false;
+    bool collecting_ = false;  // Freed by `Collect`: releases only decrement
+
+    static CycleCollectedCounter* Of(Block* block) {
+        return block;
+    }
+
+    static void Dispose(CycleCollectedCounter* counter) {
+        static_cast<Block*>(counter)->OnSharedExpired();
+    }
+
+    static void ReleaseWeak(CycleCollectedCounter* counter) {
+        static_cast<Block*>(counter)->DecreaseWeakCounter();
+    }
+};
+
+// Passed to `Trace`: `tracer(ptr)` for every `SharedPtr` the object holds.
+class CycleTracer {
+public:
+    template <typename Y>
+    void operator()(const SharedPtr<Y, CycleCollectedCounter>& ptr) {
+        if (ptr.control_block_ != nullptr) {
+            children_->push_back(CycleCollectedCounter::Of(ptr.control_block_));
+        }
+    }
+
+private:
+    friend class CycleCollector;
+
+    std::vector<CycleCollectedCounter*>* children_;
+
+    explicit CycleTracer(std::vector<CycleCollectedCounter*>* children) {
+        children_ = children;
+    }
+};
+
+class CycleCollector {
+public:
+    // Destroys the garbage cycles among the objects reachable from the candidates of this thread
+    // and returns how many objects that was. Called from a destructor, it returns 0 if a
+    // collection is already running, and otherwise destroys the garbage before the outermost
+    // release returns (see `DestructionWorklist`).
+    static size_t Collect() {
+        State& state = GetState();
+        if (state.collecting || state.exited) {
+            return 0;
+        }
+        state.collecting = true;
+        Graph graph;
+        std::vector<Counter*> roots = std::move(state.candidates);
+        state.candidates.clear();
+        graph.MarkRoots(roots);
+        graph.Scan(roots);
+        graph.CollectWhite(roots);
+        size_t freed = graph.garbage.size();
+        Sweep(std::move(graph.garbage), std::move(roots));
+        return freed;
+    }
+
+    // Buffered blocks that `Collect` will start from.
+    static size_t NumCandidates() {
+        return GetState().candidates.size();
+    }
+
+private:
+    friend class CycleCollectedCounter;
+
+    using Counter = CycleCollectedCounter;
+    using Color = CycleCollectedCounter::Color;
+
+    struct State {
+        std::vector<Counter*> candidates;
+        bool collecting = false;
+        bool exited = false;
+
+        ~State() {
+            while (!candidates.empty()) {
+                Collect();
+            }
+            exited = true;
+        }
+    };
+
+    static State& GetState() {
+        static thread_local State state;
+        return state;
+    }
+
+    static void AddCandidate(Counter* counter) {
+        State& state = GetState();
+        if (state.exited) {
+            return;
+        }
+        counter->buffered_ = true;
+        counter->IncreaseWeak();
+        state.candidates.push_back(counter);
+    }
+
+    // The three marking passes, with explicit stacks: graphs of millions of objects are common.
+    struct Graph {
+        std::vector<Counter*> stack;
+        std::vector<Counter*> black_stack;
+        std::vector<Counter*> children;
+        std::vector<Counter*> garbage;
+
+        const std::vector<Counter*>& Children(Counter* node) {
+            children.clear();
+            if (node->trace_ != nullptr) {
+                CycleTracer tracer(&children);
+                node->trace_(node->object_, tracer);
+            }
+            return children;
+        }
+
+        // Subtracts the references inside the subgraphs of the live candidates; the other
+        // candidates are dropped.
+        void MarkRoots(std::vector<Counter*>& roots) {
+            size_t kept = 0;
+            for (Counter* root : roots) {
+                root->buffered_ = false;
+                if (root->color_ == Color::kPurple && root->GetShared() > 0) {
+                    MarkGray(root);
+                    roots[kept++] = root;
+                } else {
+                    Counter::ReleaseWeak(root);
+                }
+            }
+            roots.resize(kept);
+        }
+
+        void MarkGray(Counter* root) {
+            root->color_ = Color::kGray;
+            root->trial_ = root->GetShared();
+            stack.push_back(root);
+            while (!stack.empty()) {
+                Counter* node = stack.back();
+                stack.pop_back();
+                for (Counter* child : Children(node)) {
+                    if (child->color_ != Color::kGray) {
+                        child->color_ = Color::kGray;
+                        child->trial_ = child->GetShared();
+                        stack.push_back(child);
+                    }
+                    assert(child->trial_ > 0 && "Trace reported a pointer twice");
+                    --child->trial_;
+                }
+            }
+        }
+
+        // Objects with references from outside are live, and so is everything they reach; the
+        // rest turns white.
+        void Scan(const std::vector<Counter*>& roots) {
+            stack.assign(roots.begin(), roots.end());
+            while (!stack.empty()) {
+                Counter* node = stack.back();
+                stack.pop_back();
+                if (node->color_ != Color::kGray) {
+                    continue;
+                }
+                if (node->trial_ > 0) {
+                    ScanBlack(node);
+                } else {
+                    node->color_ = Color::kWhite;
+                    const auto& children = Children(node);
+                    stack.insert(stack.end(), children.begin(), children.end());
+                }
+            }
+        }
+
+        void ScanBlack(Counter* root) {
+            root->color_ = Color::kBlack;
+            black_stack.push_back(root);
+            while (!black_stack.empty()) {
+                Counter* node = black_stack.back();
+                black_stack.pop_back();
+                for (Counter* child : Children(node)) {
+                    ++child->trial_;
+                    if (child->color_ != Color::kBlack) {
+                        child->color_ = Color::kBlack;
+                        black_stack.push_back(child);
+                    }
+                }
+            }
+        }
+
+        void CollectWhite(const std::vector<Counter*>& roots) {
+            stack.assign(roots.begin(), roots.end());
+            while (!stack.empty()) {
+                Counter* node = stack.back();
+                stack.pop_back();
+                if (node->color_ != Color::kWhite) {
+                    continue;
+                }
+                node->color_ = Color::kBlack;
+                garbage.push_back(node);
+                const auto& children = Children(node);
+                stack.insert(stack.end(), children.begin(), children.end());
+            }
+        }
+    };
+
+    // Garbage and the roots whose weak references are still held.
+    struct Swept {
+        std::vector<Counter*> garbage;
+        std::vector<Counter*> roots;
+    };
+
+    // The garbage objects release each other while they are destroyed: their blocks only count
+    // down until every object is gone, then they are freed together. `Finish` is queued below
+    // the disposals, so the worklist runs it after them and after anything they release.
+    static void Sweep(std::vector<Counter*> garbage, std::vector<Counter*> roots) {
+        for (Counter* counter : garbage) {
+            counter->IncreaseWeak();
+            counter->collecting_ = true;
+        }
+        auto* swept = new Swept{std::move(garbage), std::move(roots)};
+        DestructionWorklist::Run(swept, [](void* swept) {
+            DestructionWorklist::Run(swept, &Finish);
+            for (Counter* counter : static_cast<Swept*>(swept)->garbage) {
+                Counter::Dispose(counter);
+            }
+        });
+    }
+
+    static void Finish(void* ptr) {
+        auto* swept = static_cast<Swept*>(ptr);
+        for (Counter* counter : swept->garbage) {
+            assert(counter->GetShared() == 0 && "collected object resurrected");
+            counter->collecting_ = false;
+            Counter::ReleaseWeak(counter);
+        }
+        for (Counter* root : swept->roots) {
+            Counter::ReleaseWeak(root);
+        }
+        delete swept;
+        GetState().collecting = false;
+    }
+};
+
+inline bool CycleCollectedCounter::DecreaseShared(uint64_t count) {
+    bool expired = SingleThreadedCounter::DecreaseShared(count);
+    if (collecting_) {
+        return false;
+    }
+    if (expired) {
+        color_ = Color::kBlack;
+        return true;
+    }
+    if (trace_ != nullptr && color_ != Color::kPurple) {
+        color_ = Color::kPurple;
+        if (!buffered_) {
+            CycleCollector::AddCandidate(this);
+        }
+    }
+    return false;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "sw_fwd.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Atomic counters that move the destruction of the object off the releasing thread: the last
+// `SharedPtr` pushes the control block onto a lock-free queue and returns, and the object is
+// destroyed by the background thread of `DeferredReclaimer` (started on first use).
+//
+// Between the two, the object counts as expired: `WeakPtr::Lock` fails, while the block itself
+// stays alive until the object is gone.
+//
+// Use as `SharedPtr<T, DeferredCounter>`.
+class DeferredCounter : public AtomicCounter {
+    friend class DeferredReclaimer;
+
+public:
+    bool DecreaseShared(uint64_t count = 1);
+
+private:
+    DeferredCounter* next_ = nullptr;
+    int64_t enqueued_ns_ = 0;
+
+    static void Dispose(DeferredCounter* counter) {
+        static_cast<ControlBlock<DeferredCounter>*>(counter)->OnSharedExpired();
+    }
+};
+
+class DeferredReclaimer {
+public:
+    struct Stats {
+        size_t queue_depth;         // Released but not yet destroyed
+        size_t reclaimed;           // Destroyed so far
+        uint64_t max_latency_ns;    // Longest time from the last release to the end of destruction
+        uint64_t total_latency_ns;  // Sum over all reclaimed objects
+    };
+
+    // Waits until every object released before the call has been destroyed, including the ones
+    // released while destroying them.
+    static void Flush() {
+        DeferredReclaimer& reclaimer = Instance();
+        while (true) {
+            size_t target = reclaimer.enqueued_.load(std::memory_order_acquire);
+            size_t reclaimed;
+            while ((reclaimed = reclaimer.reclaimed_.load(std::memory_order_acquire)) < target) {
+                reclaimer.reclaimed_.wait(reclaimed, std::memory_order_acquire);
+            }
+            if (reclaimer.enqueued_.load(std::memory_order_acquire) == target) {
+                return;
+            }
+        }
+    }
+
+    // Destroys everything queued so far on the calling thread.
+    static void Drain() {
+        DeferredReclaimer& reclaimer = Instance();
+        while (reclaimer.ReclaimQueued()) {
+        }
+    }
+
+    static Stats GetStats() {
+        DeferredReclaimer& reclaimer = Instance();
+        size_t reclaimed = reclaimer.reclaimed_.load(std::memory_order_relaxed);
+        return Stats{reclaimer.enqueued_.load(std::memory_order_relaxed) - reclaimed, reclaimed,
+                     reclaimer.max_latency_ns_.load(std::memory_order_relaxed),
+                     reclaimer.total_latency_ns_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    friend class DeferredCounter;
+
+    std::atomic<DeferredCounter*> head_ = nullptr;
+    std::atomic<size_t> enqueued_ = 0;
+    std::atomic<size_t> reclaimed_ = 0;
+    std::atomic<uint64_t> max_latency_ns_ = 0;
+    std::atomic<uint64_t> total_latency_ns_ = 0;
+    std::thread thread_;
+
+    DeferredReclaimer() {
+        thread_ = std::thread([this] {
+            while (true) {
+                head_.wait(nullptr, std::memory_order_acquire);
+                ReclaimQueued();
+            }
+        });
+    }
+
+    // Never destroyed: objects may still be released by static destructors.
+    static DeferredReclaimer& Instance() {
+        static DeferredReclaimer& reclaimer = *new DeferredReclaimer();
+        return reclaimer;
+    }
+
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    void Push(DeferredCounter* counter) {
+        counter->enqueued_ns_ = Now();
+        enqueued_.fetch_add(1, std::memory_order_relaxed);
+        DeferredCounter* head = head_.load(std::memory_order_relaxed);
+        do {
+            counter->next_ = head;
+        } while (!head_.compare_exchange_weak(head, counter, std::memory_order_release,
+                                              std::memory_order_relaxed));
+        if (head == nullptr) {
+            head_.notify_one();
+        }
+    }
+
+    // Returns false if the queue was empty.
+    bool ReclaimQueued() {
+        DeferredCounter* head = head_.exchange(nullptr, std::memory_order_acquire);
+        if (head == nullptr) {
+            return false;
+        }
+        // The queue is a stack: reverse it to destroy in release order.
+        DeferredCounter* ordered = nullptr;
+        while (head != nullptr) {
+            DeferredCounter* next = head->next_;
+            head->next_ = ordered;
+            ordered = head;
+            head = next;
+        }
+        while (ordered != nullptr) {
+            DeferredCounter* next = ordered->next_;
+            int64_t enqueued_ns = ordered->enqueued_ns_;
+            DeferredCounter::Dispose(ordered);
+            RecordLatency(Now() - enqueued_ns);
+            reclaimed_.fetch_add(1, std::memory_order_release);
+            ordered = next;
+        }
+        reclaimed_.notify_all();
+        return true;
+    }
+
+    void RecordLatency(int64_t latency_ns) {
+        auto latency = static_cast<uint64_t>(latency_ns);
+        total_latency_ns_.fetch_add(latency, std::memory_order_relaxed);
+        uint64_t max = max_latency_ns_.load(std::memory_order_relaxed);
+        while (latency > max &&
+               !max_latency_ns_.compare_exchange_weak(max, latency, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+inline bool DeferredCounter::DecreaseShared(uint64_t count) {
+    if (AtomicCounter::DecreaseShared(count)) {
+        DeferredReclaimer::Instance().Push(this);
+    }
+    return false;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "shared.h"
+
+#include <common/hazard_pointers.h>
+
+#include <atomic>
+#include <utility>
+
+// A `SharedPtr` slot for lock-free structures whose readers do not touch any counter.
+//
+//     HazardPointer hazard;
+//     const Config* config = slot.Protect(hazard);  // No counter traffic
+//
+// Like `AtomicSharedPtr`, the stored pointer lives in a holder: a control block whose object is
+// the `SharedPtr`. Readers protect the holder with a hazard pointer and use the object while the
+// hazard pointer stays on it; writers swap in a new holder and retire the old one to
+// `HazardDomain`, which releases it once no reader is left. `Load` still returns an owning
+// `SharedPtr` for readers that keep the object.
+template <typename T, typename Counter = AtomicCounter>
+class HazardSharedPtr {
+    using Pointer = SharedPtr<T, Counter>;
+    using Holder = ControlBlockObject<Pointer, SingleThreadedCounter>;
+    using ElementType = typename Pointer::ElementType;
+
+public:
+    HazardSharedPtr() = default;
+
+    HazardSharedPtr(Pointer desired) {
+        holder_.store(MakeHolder(std::move(desired)), std::memory_order_relaxed);
+    }
+
+    HazardSharedPtr(const HazardSharedPtr&) = delete;
+    HazardSharedPtr& operator=(const HazardSharedPtr&) = delete;
+
+    // No reader may be left.
+    ~HazardSharedPtr() {
+        if (Holder* holder = holder_.load(std::memory_order_relaxed)) {
+            holder->DecreaseSharedCounter();
+        }
+    }
+
+    // Valid until `hazard` protects something else.
+    ElementType* Protect(HazardPointer& hazard) const {
+        Holder* holder = hazard.Protect(holder_);
+        return holder == nullptr ? nullptr : holder->GetPointer()->Get();
+    }
+
+    Pointer Load() const {
+        HazardPointer hazard;
+        Holder* holder = hazard.Protect(holder_);
+        return holder == nullptr ? Pointer() : *holder->GetPointer();
+    }
+
+    void Store(Pointer desired) {
+        Retire(holder_.exchange(MakeHolder(std::move(desired)), std::memory_order_acq_rel));
+    }
+
+    // Readers may still be copying the old pointer, so it is copied too, not moved out.
+    Pointer Exchange(Pointer desired) {
+        Holder* holder =
+            holder_.exchange(MakeHolder(std::move(desired)), std::memory_order_acq_rel);
+        if (holder == nullptr) {
+            return Pointer();
+        }
+        Pointer previous = *holder->GetPointer();
+        Retire(holder);
+        return previous;
+    }
+
+private:
+    std::atomic<Holder*> holder_ = nullptr;
+
+    static Holder* MakeHolder(Pointer desired) {
+        if (desired.UseCount() == 0) {
+            return nullptr;
+        }
+        return new Holder(std::move(desired));
+    }
+
+    static void Retire(Holder* holder) {
+        if (holder == nullptr) {
+            return;
+        }
+        HazardDomain::Retire(holder, [](void* ptr) {
+            static_cast<Holder*>(ptr)->DecreaseSharedCounter();
+        });
+    }
+};
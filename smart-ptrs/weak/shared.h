@@ -3,17 +3,37 @@
 #include "sw_fwd.h"  // Forward declaration
 
 #include <cstddef>  // std::nullptr_t
+#include <span>
+#include <type_traits>
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
-template <typename T>
+// `SharedPtr<T[]>` and `SharedPtr<T[N]>` own arrays: `delete[]` and `operator[]`.
+template <typename T, typename Counter>
 class SharedPtr {
-    template <typename Y>
+    template <typename Y, typename C>
     friend class SharedPtr;
 
-    template <typename Y>
+    template <typename Y, typename C>
     friend class WeakPtr;
 
+    template <typename Y>
+    friend class AtomicSharedPtr;
+
+    template <typename Y, typename C>
+    friend class Borrowed;
+
+    template <typename Y, typename C>
+    friend class EnableSharedFromThis;
+
+    friend class CycleTracer;
+
+    template <typename Y, typename C>
+    friend void CloneN(const SharedPtr<Y, C>& ptr,
+                       std::type_identity_t<std::span<SharedPtr<Y, C>>> out);
+
 public:
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -27,15 +47,30 @@ public:
         ptr_ = nullptr;
     }
 
-    explicit SharedPtr(T* ptr) {
-        control_block_ = new ControlBlockPtr<T>(ptr);
+    explicit SharedPtr(ElementType* ptr) {
+        control_block_ = new ControlBlockPtr<T, Counter>(ptr);
         ptr_ = ptr;
+        AdoptObject(ptr);
     }
 
     template <typename Y>
     explicit SharedPtr(Y* ptr) {
-        control_block_ = new ControlBlockPtr<Y>(ptr);
+        control_block_ = new ControlBlockPtr<Owned<Y>, Counter>(ptr);
+        ptr_ = ptr;
+        AdoptObject(ptr);
+    }
+
+    template <typename Y, typename Deleter>
+    SharedPtr(Y* ptr, Deleter deleter) : SharedPtr(ptr, std::move(deleter), std::allocator<Y>()) {
+    }
+
+    // The control block is allocated with `alloc` (rebound to the block type).
+    template <typename Y, typename Deleter, typename Alloc>
+    SharedPtr(Y* ptr, Deleter deleter, const Alloc& alloc) {
+        control_block_ = ControlBlockPtrAllocator<Y, Deleter, Alloc, Counter>::Create(
+            ptr, std::move(deleter), alloc);
         ptr_ = ptr;
+        AdoptObject(ptr);
     }
 
     SharedPtr(const SharedPtr& other) {
@@ -45,7 +80,7 @@ public:
     }
 
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other) {
+    SharedPtr(const SharedPtr<Y, Counter>& other) {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
         IncreaseCounter();
@@ -59,14 +94,27 @@ public:
     }
 
     template <typename Y>
-    SharedPtr(SharedPtr<Y>&& other) {
+    SharedPtr(SharedPtr<Y, Counter>&& other) {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
         other.control_block_ = nullptr;
         other.ptr_ = nullptr;
     }
 
-    explicit SharedPtr(ControlBlockObject<T>* ptr) {
+    explicit SharedPtr(ControlBlockObject<T, Counter>* ptr) {
+        control_block_ = ptr;
+        ptr_ = ptr->GetPointer();
+        AdoptObject(ptr_);
+    }
+
+    template <typename Alloc>
+    explicit SharedPtr(ControlBlockObjectAllocator<T, Alloc, Counter>* ptr) {
+        control_block_ = ptr;
+        ptr_ = ptr->GetPointer();
+        AdoptObject(ptr_);
+    }
+
+    explicit SharedPtr(ControlBlockArray<ElementType, Counter>* ptr) {
         control_block_ = ptr;
         ptr_ = ptr->GetPointer();
     }
@@ -74,7 +122,7 @@ public:
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) {
+    SharedPtr(const SharedPtr<Y, Counter>& other, ElementType* ptr) {
         control_block_ = other.control_block_;
         ptr_ = ptr;
         IncreaseCounter();
@@ -82,13 +130,12 @@ public:
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.Expired()) {
+    explicit SharedPtr(const WeakPtr<T, Counter>& other) {
+        if (other.control_block_ == nullptr || !other.control_block_->TryIncreaseSharedCounter()) {
             throw BadWeakPtr();
         }
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
-        IncreaseCounter();
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -133,17 +180,29 @@ public:
         ptr_ = nullptr;
     }
 
-    void Reset(T* ptr) {
+    void Reset(ElementType* ptr) {
         DecreaseCounter();
-        control_block_ = new ControlBlockPtr<T>(ptr);
+        control_block_ = new ControlBlockPtr<T, Counter>(ptr);
         ptr_ = ptr;
+        AdoptObject(ptr);
     }
 
     template <typename Y>
     void Reset(Y* ptr) {
         DecreaseCounter();
-        control_block_ = new ControlBlockPtr<Y>(ptr);
+        control_block_ = new ControlBlockPtr<Owned<Y>, Counter>(ptr);
         ptr_ = ptr;
+        AdoptObject(ptr);
+    }
+
+    template <typename Y, typename Deleter>
+    void Reset(Y* ptr, Deleter deleter) {
+        SharedPtr(ptr, std::move(deleter)).Swap(*this);
+    }
+
+    template <typename Y, typename Deleter, typename Alloc>
+    void Reset(Y* ptr, Deleter deleter, const Alloc& alloc) {
+        SharedPtr(ptr, std::move(deleter), alloc).Swap(*this);
     }
 
     void Swap(SharedPtr& other) {
@@ -154,18 +213,24 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
+    ElementType* Get() const {
         return ptr_;
     }
 
-    T& operator*() const {
+    ElementType& operator*() const {
         return *ptr_;
     }
 
-    T* operator->() const {
+    ElementType* operator->() const {
         return ptr_;
     }
 
+    ElementType& operator[](ptrdiff_t index) const
+        requires std::is_array_v<T>
+    {
+        return ptr_[index];
+    }
+
     size_t UseCount() const {
         if (control_block_ == nullptr) {
             return 0;
@@ -183,8 +248,12 @@ public:
     }
 
 private:
-    ControlBlock* control_block_;
-    T* ptr_;
+    // What a raw `Y*` given to the constructor owns: an array if this is an array pointer.
+    template <typename Y>
+    using Owned = std::conditional_t<std::is_array_v<T>, Y[], Y>;
+
+    ControlBlock<Counter>* control_block_;
+    ElementType* ptr_;
 
     void IncreaseCounter() {
         if (control_block_ == nullptr) {
@@ -198,32 +267,231 @@ private:
             return;
         }
         control_block_->DecreaseSharedCounter();
-        if (UseCount() == 0 && UseWeakCount() == 0) {
-            delete control_block_;
-        }
         control_block_ = nullptr;
         ptr_ = nullptr;
     }
+
+    template <typename X>
+    static EnableSharedFromThis<X, Counter>* FindEnableShared(
+        const EnableSharedFromThis<X, Counter>* base) {
+        return const_cast<EnableSharedFromThis<X, Counter>*>(base);
+    }
+
+    // Called by every new owner of an object. Resolved at compile time: nothing happens for
+    // other types and policies.
+    //  * An object derived from `EnableSharedFromThis` gets a weak reference to its control block,
+    //    unless a live owner already did.
+    //  * A policy with `Adopt` learns the type of the object (see `CycleCollectedCounter`).
+    template <typename Y>
+    void AdoptObject(Y* ptr) {
+        if constexpr (!std::is_array_v<T> && requires { FindEnableShared(ptr); }) {
+            if (ptr != nullptr) {
+                FindEnableShared(ptr)->Attach(control_block_);
+            }
+        }
+        if constexpr (!std::is_array_v<T> && requires { Counter::Adopt(control_block_, ptr); }) {
+            if (ptr != nullptr) {
+                Counter::Adopt(control_block_, ptr);
+            }
+        }
+    }
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
+namespace detail {
+// Large objects for `MakeShared`: the object is freed as soon as it is destroyed.
+template <typename Counter, typename T>
+SharedPtr<T, Counter> ShareSeparate(T* ptr) {
+    try {
+        return SharedPtr<T, Counter>(ptr);
+    } catch (...) {
+        delete ptr;
+        throw;
+    }
+}
+}  // namespace detail
+
+// Fills `out` (a vector, an array, a span) with copies of `ptr` using one counter update instead
+// of one per copy, e.g. to broadcast a message to many subscribers. Pointers already in `out` are
+// released.
+template <typename T, typename Counter>
+void CloneN(const SharedPtr<T, Counter>& ptr,
+            std::type_identity_t<std::span<SharedPtr<T, Counter>>> out) {
+    ControlBlock<Counter>* control_block = ptr.control_block_;
+    auto* object = ptr.ptr_;
+    if (control_block != nullptr && !out.empty()) {
+        control_block->IncreaseSharedCounter(out.size());
+    }
+    for (SharedPtr<T, Counter>& copy : out) {
+        copy.DecreaseCounter();
+        copy.control_block_ = control_block;
+        copy.ptr_ = object;
+    }
+}
+
+template <typename T, typename U, typename Counter>
+inline bool operator==(const SharedPtr<T, Counter>& left, const SharedPtr<U, Counter>& right) {
     return left.Get() == right.Get();
 }
 
-// Allocate memory only once
-template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-    return SharedPtr<T>(new ControlBlockObject<T>(std::forward<Args>(args)...));
+// Allocate memory only once, unless the object is large enough to be freed on its own (see
+// `kSeparateObjectBytes`)
+template <typename T, typename Counter = SingleThreadedCounter, typename... Args>
+    requires(!std::is_array_v<T>)
+SharedPtr<T, Counter> MakeShared(Args&&... args) {
+    if constexpr (sizeof(T) >= kSeparateObjectBytes) {
+        return detail::ShareSeparate<Counter>(new T(std::forward<Args>(args)...));
+    } else {
+        return SharedPtr<T, Counter>(
+            new ControlBlockObject<T, Counter>(std::forward<Args>(args)...));
+    }
+}
+
+// `MakeShared<T[]>(n)`: `n` value-initialized elements in the same allocation as the block.
+template <typename T, typename Counter = SingleThreadedCounter>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T, Counter> MakeShared(size_t size) {
+    return SharedPtr<T, Counter>(ControlBlockArray<std::remove_extent_t<T>, Counter>::Create(size));
 }
 
-// Look for usage examples in tests
-template <typename T>
+// `MakeShared<T[]>(n, init)`: `n` copies of `init`.
+template <typename T, typename Counter = SingleThreadedCounter>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T, Counter> MakeShared(size_t size, const std::remove_extent_t<T>& init) {
+    return SharedPtr<T, Counter>(
+        ControlBlockArray<std::remove_extent_t<T>, Counter>::Create(size, init));
+}
+
+template <typename T, typename Counter = SingleThreadedCounter>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T, Counter> MakeShared() {
+    return SharedPtr<T, Counter>(
+        ControlBlockArray<std::remove_extent_t<T>, Counter>::Create(std::extent_v<T>));
+}
+
+template <typename T, typename Counter = SingleThreadedCounter>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T, Counter> MakeShared(const std::remove_extent_t<T>& init) {
+    return SharedPtr<T, Counter>(
+        ControlBlockArray<std::remove_extent_t<T>, Counter>::Create(std::extent_v<T>, init));
+}
+
+// Like `MakeShared`, but default-initialized: no zeroing of buffers that are about to be
+// overwritten anyway.
+template <typename T, typename Counter = SingleThreadedCounter>
+    requires(!std::is_array_v<T>)
+SharedPtr<T, Counter> MakeSharedForOverwrite() {
+    if constexpr (sizeof(T) >= kSeparateObjectBytes) {
+        return detail::ShareSeparate<Counter>(new T);
+    } else {
+        return SharedPtr<T, Counter>(new ControlBlockObject<T, Counter>(detail::ForOverwrite()));
+    }
+}
+
+template <typename T, typename Counter = SingleThreadedCounter>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T, Counter> MakeSharedForOverwrite(size_t size) {
+    return SharedPtr<T, Counter>(
+        ControlBlockArray<std::remove_extent_t<T>, Counter>::Create(size, detail::ForOverwrite()));
+}
+
+template <typename T, typename Counter = SingleThreadedCounter>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T, Counter> MakeSharedForOverwrite() {
+    return SharedPtr<T, Counter>(ControlBlockArray<std::remove_extent_t<T>, Counter>::Create(
+        std::extent_v<T>, detail::ForOverwrite()));
+}
+
+// Like `MakeShared`, but the control block with the object inside is allocated, constructed and
+// destroyed through `alloc`.
+template <typename T, typename Counter = SingleThreadedCounter, typename Alloc, typename... Args>
+SharedPtr<T, Counter> AllocateShared(const Alloc& alloc, Args&&... args) {
+    return SharedPtr<T, Counter>(
+        ControlBlockObjectAllocator<T, Alloc, Counter>::Create(alloc, std::forward<Args>(args)...));
+}
+
+// Lets an object owned by `SharedPtr`s get more of them from `this`:
+// `class Session : public EnableSharedFromThis<Session>`.
+//
+// The object itself holds a weak reference to its control block, set by the first owner (any
+// `SharedPtr` constructor or `Reset` that takes ownership, `MakeShared`, `AllocateShared`), so
+// `SharedFromThis` is a single counter increment with no lookup and no extra allocation. Throws
+// `BadWeakPtr` for objects no `SharedPtr` owns. `WeakFromThis` needs `weak.h`.
+template <typename T, typename Counter>
 class EnableSharedFromThis {
+    template <typename Y, typename C>
+    friend class SharedPtr;
+
 public:
-    SharedPtr<T> SharedFromThis();
-    SharedPtr<const T> SharedFromThis() const;
+    SharedPtr<T, Counter> SharedFromThis() {
+        return Share<T>(static_cast<T*>(this));
+    }
+
+    SharedPtr<const T, Counter> SharedFromThis() const {
+        return Share<const T>(static_cast<const T*>(this));
+    }
+
+    WeakPtr<T, Counter> WeakFromThis() noexcept {
+        return Observe<T>(static_cast<T*>(this));
+    }
+
+    WeakPtr<const T, Counter> WeakFromThis() const noexcept {
+        return Observe<const T>(static_cast<const T*>(this));
+    }
 
-    WeakPtr<T> WeakFromThis() noexcept;
-    WeakPtr<const T> WeakFromThis() const noexcept;
+protected:
+    EnableSharedFromThis() noexcept {
+        control_block_ = nullptr;
+    }
+
+    // Copies belong to whoever owns them, not to the owner of the original.
+    EnableSharedFromThis(const EnableSharedFromThis&) noexcept {
+        control_block_ = nullptr;
+    }
+
+    EnableSharedFromThis& operator=(const EnableSharedFromThis&) noexcept {
+        return *this;
+    }
+
+    ~EnableSharedFromThis() {
+        if (control_block_ != nullptr) {
+            control_block_->DecreaseWeakCounter();
+        }
+    }
+
+private:
+    // A weak reference, or null while no `SharedPtr` owns the object.
+    mutable ControlBlock<Counter>* control_block_;
+
+    void Attach(ControlBlock<Counter>* control_block) const {
+        if (control_block_ != nullptr) {
+            if (control_block_->GetSharedCount() != 0) {
+                return;
+            }
+            control_block_->DecreaseWeakCounter();
+        }
+        control_block->IncreaseWeakCounter();
+        control_block_ = control_block;
+    }
+
+    template <typename Y>
+    SharedPtr<Y, Counter> Share(Y* ptr) const {
+        if (control_block_ == nullptr || !control_block_->TryIncreaseSharedCounter()) {
+            throw BadWeakPtr();
+        }
+        SharedPtr<Y, Counter> result;
+        result.control_block_ = control_block_;
+        result.ptr_ = ptr;
+        return result;
+    }
+
+    template <typename Y>
+    WeakPtr<Y, Counter> Observe(Y* ptr) const {
+        WeakPtr<Y, Counter> result;
+        if (control_block_ != nullptr) {
+            control_block_->IncreaseWeakCounter();
+            result.control_block_ = control_block_;
+            result.ptr_ = ptr;
+        }
+        return result;
+    }
 };
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "shared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Read-mostly shared value, e.g. configuration, in the style of RCU: readers use a copy cached
+// by their thread and write no shared memory at all.
+//
+//     Snapshot<Config> config(MakeShared<Config, AtomicCounter>(...));
+//     const SharedPtr<Config, AtomicCounter>& current = config.Read();  // Reader
+//     config.Publish(MakeShared<Config, AtomicCounter>(...));            // Writer
+//
+// Every thread keeps its own `SharedPtr` to the value together with the version it copied.
+// `Read` compares that version with the published one, a plain load of a line that only writers
+// modify, and copies the value again only after a `Publish`. The counter of the value is thus
+// touched once per thread and version instead of once per read.
+//
+// An old value lives until every thread that read it has read again, or has exited. The
+// destructor of a snapshot releases the copies cached by all threads.
+template <typename T, typename Counter = AtomicCounter>
+class Snapshot {
+    using Pointer = SharedPtr<T, Counter>;
+
+public:
+    explicit Snapshot(Pointer initial = Pointer()) {
+        current_ = std::move(initial);
+        Registry::Instance().AcquireSlot(&slot_, &id_);
+    }
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // No thread may be reading.
+    ~Snapshot() {
+        Registry::Instance().ReleaseSlot(slot_, id_);
+    }
+
+    // The value as of the latest `Publish` this thread has seen. The reference stays valid until
+    // this thread reads this snapshot again; copy it to keep the value longer.
+    const Pointer& Read() const {
+        Cache& cache = GetCache();
+        assert(!cache.exited && "Snapshot read during thread exit");
+        if (slot_ < cache.entries.size()) [[likely]] {
+            const Entry& entry = cache.entries[slot_];
+            if (entry.id == id_ && entry.version == version_.load(std::memory_order_acquire)) {
+                return entry.value;
+            }
+        }
+        return Refresh(cache);
+    }
+
+    // Replaces the value; readers pick it up on their next `Read`.
+    void Publish(Pointer value) {
+        {
+            std::lock_guard lock(mutex_);
+            current_.Swap(value);
+            version_.fetch_add(1, std::memory_order_release);
+        }
+        // The old value is released outside the lock.
+    }
+
+    // The latest value, copied under the lock of writers.
+    Pointer Load() const {
+        std::lock_guard lock(mutex_);
+        return current_;
+    }
+
+    uint64_t Version() const {
+        return version_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Entry {
+        uint64_t id = 0;
+        uint64_t version = 0;
+        Pointer value;
+    };
+
+    // Entries never move: references handed out by `Read` survive the growth of the cache. The
+    // mutex keeps the growth apart from destructors of snapshots clearing their entries.
+    struct Cache {
+        std::mutex mutex;
+        std::deque<Entry> entries;
+        bool exited = false;
+
+        Cache() {
+            Registry::Instance().Add(this);
+        }
+
+        ~Cache() {
+            Registry::Instance().Remove(this);
+            std::deque<Entry> released;
+            {
+                std::lock_guard lock(mutex);
+                released.swap(entries);
+            }
+            exited = true;
+        }
+    };
+
+    // Cache entries are indexed by slot. Slots of destroyed snapshots are reused; the unique id
+    // tells a reused slot from the old one.
+    class Registry {
+    public:
+        // Never destroyed: snapshots may be static.
+        static Registry& Instance() {
+            static Registry& registry = *new Registry();
+            return registry;
+        }
+
+        void AcquireSlot(size_t* slot, uint64_t* id) {
+            std::lock_guard lock(mutex_);
+            if (free_.empty()) {
+                *slot = num_slots_++;
+            } else {
+                *slot = free_.back();
+                free_.pop_back();
+            }
+            *id = ++last_id_;
+        }
+
+        // Values are released outside the locks: their destructors may read snapshots.
+        void ReleaseSlot(size_t slot, uint64_t id) {
+            std::vector<Pointer> released;  // Destroyed after the lock is released
+            std::lock_guard lock(mutex_);
+            for (Cache* cache : caches_) {
+                std::lock_guard cache_lock(cache->mutex);
+                if (slot < cache->entries.size() && cache->entries[slot].id == id) {
+                    Entry& entry = cache->entries[slot];
+                    released.push_back(std::move(entry.value));
+                    entry.id = 0;
+                }
+            }
+            free_.push_back(slot);
+        }
+
+        void Add(Cache* cache) {
+            std::lock_guard lock(mutex_);
+            caches_.push_back(cache);
+        }
+
+        void Remove(Cache* cache) {
+            std::lock_guard lock(mutex_);
+            caches_.erase(std::find(caches_.begin(), caches_.end(), cache));
+        }
+
+    private:
+        std::mutex mutex_;
+        std::vector<Cache*> caches_;
+        std::vector<size_t> free_;
+        size_t num_slots_ = 0;
+        uint64_t last_id_ = 0;
+    };
+
+    // Only writers write this line.
+    alignas(64) std::atomic<uint64_t> version_ = 1;
+    size_t slot_;
+    uint64_t id_;
+
+    alignas(64) mutable std::mutex mutex_;
+    Pointer current_;
+
+    static Cache& GetCache() {
+        static thread_local Cache cache;
+        return cache;
+    }
+
+    // The version is read before the value: a `Publish` in between only makes the next `Read`
+    // copy once more.
+    const Pointer& Refresh(Cache& cache) const {
+        if (slot_ >= cache.entries.size()) {
+            std::lock_guard lock(cache.mutex);
+            cache.entries.resize(slot_ + 1);
+        }
+        Entry& entry = cache.entries[slot_];
+        uint64_t version = version_.load(std::memory_order_acquire);
+        Pointer value = Load();
+        // The previous value may hold the last reference to an object whose destructor reads
+        // snapshots: release it after the entry is consistent.
+        entry.value.Swap(value);
+        entry.id = id_;
+        entry.version = version;
+        return entry.value;
+    }
+};
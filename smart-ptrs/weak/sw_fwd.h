@@ -1,120 +1,635 @@
 #pragma once
 
+#include <common/destruction_worklist.h>
+#include <common/slab_allocator.h>
+#include <common/stats.h>
+#include <unique/compressed_pair.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Counter policies
+//
+// Both counters live in one 64-bit word: shared references in the upper half, weak ones in the
+// lower half. The weak half holds one extra reference while there are shared ones, so
+//  * a shared release is one decrement of the word and one check of the upper half;
+//  * a weak release is one decrement and a check that the whole word is zero, and whoever gets
+//    there is the only one who frees the control block.
+// Each half holds up to 2^32 - 1 references.
+
+namespace detail {
+constexpr uint64_t kSharedOne = uint64_t{1} << 32;
+constexpr uint64_t kWeakOne = 1;
+constexpr uint64_t kWeakMask = kSharedOne - 1;
+
+// Selects default-initialization (`new T` rather than `new T()`) in the control blocks.
+struct ForOverwrite {};
+}  // namespace detail
+
+// Plain counters: the cheapest option for pointers that never leave their thread.
+class SingleThreadedCounter {
+public:
+    void IncreaseShared(uint64_t count = 1) {
+        counters_ += count * detail::kSharedOne;
+    }
+
+    // Returns true if the last shared reference is gone.
+    bool DecreaseShared(uint64_t count = 1) {
+        counters_ -= count * detail::kSharedOne;
+        return counters_ < detail::kSharedOne;
+    }
+
+    bool TryIncreaseShared() {
+        if (counters_ < detail::kSharedOne) {
+            return false;
+        }
+        counters_ += detail::kSharedOne;
+        return true;
+    }
+
+    void IncreaseWeak() {
+        counters_ += detail::kWeakOne;
+    }
+
+    // Returns true if the last weak reference is gone.
+    bool DecreaseWeak() {
+        counters_ -= detail::kWeakOne;
+        return counters_ == 0;
+    }
+
+    size_t GetShared() const {
+        return counters_ >> 32;
+    }
+
+    size_t GetWeak() const {
+        return (counters_ & detail::kWeakMask) - (counters_ >= detail::kSharedOne ? 1 : 0);
+    }
+
+private:
+    uint64_t counters_ = detail::kSharedOne + detail::kWeakOne;
+};
+
+// Atomic counters: safe to share between threads.
+// Increments are relaxed (the caller already holds a reference), decrements are acq_rel so that
+// every write to the object happens before its destruction.
+class AtomicCounter {
+public:
+    void IncreaseShared(uint64_t count = 1) {
+        counters_.fetch_add(count * detail::kSharedOne, std::memory_order_relaxed);
+    }
+
+    bool DecreaseShared(uint64_t count = 1) {
+        return counters_.fetch_sub(count * detail::kSharedOne, std::memory_order_acq_rel) <
+               (count + 1) * detail::kSharedOne;
+    }
+
+    bool TryIncreaseShared() {
+        uint64_t counters = counters_.load(std::memory_order_relaxed);
+        while (counters >= detail::kSharedOne) {
+            if (counters_.compare_exchange_weak(counters, counters + detail::kSharedOne,
+                                                std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void IncreaseWeak() {
+        counters_.fetch_add(detail::kWeakOne, std::memory_order_relaxed);
+    }
+
+    bool DecreaseWeak() {
+        return counters_.fetch_sub(detail::kWeakOne, std::memory_order_acq_rel) ==
+               detail::kWeakOne;
+    }
+
+    size_t GetShared() const {
+        return counters_.load(std::memory_order_relaxed) >> 32;
+    }
+
+    size_t GetWeak() const {
+        uint64_t counters = counters_.load(std::memory_order_relaxed);
+        return (counters & detail::kWeakMask) - (counters >= detail::kSharedOne ? 1 : 0);
+    }
+
+private:
+    std::atomic<uint64_t> counters_ = detail::kSharedOne + detail::kWeakOne;
+};
+
+template <typename T, typename Counter = SingleThreadedCounter>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Counter = SingleThreadedCounter>
 class WeakPtr;
 
-class ControlBlock {
+template <typename T>
+class AtomicSharedPtr;
+
+template <typename T, typename Counter = SingleThreadedCounter>
+class Borrowed;
+
+template <typename T, typename Counter = SingleThreadedCounter>
+class EnableSharedFromThis;
+
+#ifndef NDEBUG
+namespace detail {
+// Debug builds count the live `Borrowed` views of every control block, so that destroying an
+// object that is still borrowed fails an assertion.
+class BorrowRegistry {
+public:
+    static void Add(const void* block) {
+        BorrowRegistry& registry = Instance();
+        std::lock_guard lock(registry.mutex_);
+        ++registry.borrows_[block];
+        registry.live_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void Remove(const void* block) {
+        BorrowRegistry& registry = Instance();
+        std::lock_guard lock(registry.mutex_);
+        auto it = registry.borrows_.find(block);
+        if (--it->second == 0) {
+            registry.borrows_.erase(it);
+        }
+        registry.live_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    static bool IsBorrowed(const void* block) {
+        BorrowRegistry& registry = Instance();
+        if (registry.live_.load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+        std::lock_guard lock(registry.mutex_);
+        return registry.borrows_.contains(block);
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<const void*, size_t> borrows_;
+    std::atomic<size_t> live_ = 0;
+
+    // Outlives static destructors, which may still release borrowed pointers.
+    static BorrowRegistry& Instance() {
+        static BorrowRegistry& registry = *new BorrowRegistry();
+        return registry;
+    }
+};
+}  // namespace detail
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Object storage and weak references
+//
+// `MakeShared` places the object inside the control block, so its memory stays allocated after
+// the object is destroyed for as long as weak references keep the block alive. Objects and arrays
+// of at least `kSeparateObjectBytes` get an allocation of their own instead, which is freed
+// together with the object.
+
+constexpr size_t kSeparateObjectBytes = 64 * 1024;
+
+namespace detail {
+inline std::atomic<size_t> zombie_bytes = 0;
+
+inline void AddZombieBytes(size_t bytes) {
+    zombie_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline void RemoveZombieBytes(size_t bytes) {
+    zombie_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+}  // namespace detail
+
+// Bytes of destroyed objects that are still allocated because weak references keep their control
+// blocks alive.
+inline size_t ZombieBytes() {
+    return detail::zombie_bytes.load(std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Control blocks
+
+// The counter policy is a base class, so a policy can get back to its block when it has to
+// finish a release on behalf of another thread (see `BiasedCounter`).
+//
+// There are no virtual functions: every concrete block passes its static `Manage` function to
+// the constructor. When the last shared reference goes away, one indirect call destroys the
+// object and, unless weak references are left, frees the block as well.
+//
+// Blocks created with plain `new` come from the per-thread `SlabAllocator`. Blocks with a user
+// allocator are placed with `::new` and never go through these operators.
+template <typename Counter>
+class ControlBlock : private Counter {
+    friend Counter;
+
 public:
-    virtual ~ControlBlock() = default;
+    enum class Operation {
+        kDispose,    // Destroy the object, then release the weak reference held for it.
+        kDeallocate  // Free the block: the object is gone and so are the weak references.
+    };
+
+    using Manager = void (*)(ControlBlock*, Operation);
 
     void IncreaseSharedCounter() {
-        ++shared_counter_;
+        Counter::IncreaseShared();
+    }
+
+    // Takes or drops `count` references with one counter update (see `CloneN`); only for
+    // policies that support it.
+    void IncreaseSharedCounter(size_t count) {
+        Counter::IncreaseShared(count);
+    }
+
+    void DecreaseSharedCounter(size_t count) {
+        if (Counter::DecreaseShared(count)) {
+            OnSharedExpired();
+        }
+    }
+
+    // Used by `WeakPtr::Lock`: never resurrects an expired object.
+    bool TryIncreaseSharedCounter() {
+        return Counter::TryIncreaseShared();
     }
 
     void IncreaseWeakCounter() {
-        ++weak_counter_;
+        Counter::IncreaseWeak();
     }
 
     void DecreaseSharedCounter() {
-        --shared_counter_;
-        if (shared_counter_ == 0) {
-            Destroy();
+        if (Counter::DecreaseShared()) {
+            OnSharedExpired();
         }
     }
 
     void DecreaseWeakCounter() {
-        --weak_counter_;
+        if (Counter::DecreaseWeak()) {
+            manager_(this, Operation::kDeallocate);
+        }
     }
 
     size_t GetSharedCount() const {
-        return shared_counter_;
+        return Counter::GetShared();
     }
 
     size_t GetWeakCount() const {
-        return weak_counter_;
+        return Counter::GetWeak();
     }
 
-private:
-    virtual void Destroy() = 0;
+    static void* operator new(size_t size) {
+        return SlabAllocator::Allocate(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        SlabAllocator::Deallocate(ptr, size);
+    }
+
+    // Over-aligned objects are rare enough to leave to the global allocator.
+    static void* operator new(size_t size, std::align_val_t alignment) {
+        return ::operator new(size, alignment);
+    }
+
+    static void operator delete(void* ptr, size_t size, std::align_val_t alignment) {
+        ::operator delete(ptr, size, alignment);
+    }
 
 protected:
-    size_t shared_counter_;
-    size_t weak_counter_;
+    explicit ControlBlock(Manager manager) : manager_(manager) {
+        CountStat(Stat::kControlBlocksAllocated);
+    }
+
+    ~ControlBlock() {
+        CountStat(Stat::kControlBlocksFreed);
+        if constexpr (kSmartPtrStatsEnabled) {
+            // Freed without disposal: constructing the object threw. Keeps the live counts right.
+            if (GetSharedCount() != 0) {
+                CountStat(Stat::kObjectsDestroyed);
+            }
+        }
+    }
+
+    // For `Manage` after disposal: returns true if the block has to be freed right away.
+    bool ReleaseDisposedWeak() {
+        return Counter::DecreaseWeak();
+    }
+
+private:
+    Manager manager_;
+
+    // Nested disposals (an object holding the last pointer to another one) are queued by
+    // `DestructionWorklist`, so long chains are destroyed in constant stack.
+    void OnSharedExpired() {
+        assert(!detail::BorrowRegistry::IsBorrowed(this) && "object destroyed while borrowed");
+        CountStat(Stat::kObjectsDestroyed);
+        DestructionWorklist::Run(this, [](void* block) {
+            auto* self = static_cast<ControlBlock*>(block);
+            self->manager_(self, Operation::kDispose);
+        });
+    }
 };
 
-template <typename T>
-class ControlBlockPtr : public ControlBlock {
+// `T` is the owned type: `U[]` owns an array from `new U[n]` and frees it with `delete[]`.
+template <typename T, typename Counter>
+class ControlBlockPtr : public ControlBlock<Counter> {
+    using Base = ControlBlock<Counter>;
+    using Element = std::remove_extent_t<T>;
+
 public:
-    ControlBlockPtr(T* ptr) {
+    ControlBlockPtr(Element* ptr) : Base(&Manage) {
         ptr_ = ptr;
-        shared_counter_ = 1;
-        weak_counter_ = 0;
     }
 
-    ControlBlockPtr(const ControlBlockPtr& other) {
-        ptr_ = other.ptr_;
-        shared_counter_ = other.shared_counter_;
+private:
+    Element* ptr_;
+
+    static void Manage(Base* base, typename Base::Operation operation) {
+        auto* block = static_cast<ControlBlockPtr*>(base);
+        if (operation == Base::Operation::kDispose) {
+            if constexpr (std::is_array_v<T>) {
+                delete[] block->ptr_;
+            } else {
+                delete block->ptr_;
+            }
+            if (!block->ReleaseDisposedWeak()) {
+                return;
+            }
+        }
+        delete block;
+    }
+};
+
+template <typename T, typename Counter>
+class ControlBlockObject : public ControlBlock<Counter> {
+    using Base = ControlBlock<Counter>;
+
+public:
+    template <typename... Args>
+    ControlBlockObject(Args&&... args) : Base(&Manage) {
+        ::new (&ptr_) T(std::forward<Args>(args)...);
+        CountStat(Stat::kObjectBlockBytesAllocated, sizeof(ControlBlockObject));
+    }
+
+    explicit ControlBlockObject(detail::ForOverwrite) : Base(&Manage) {
+        ::new (&ptr_) T;
+        CountStat(Stat::kObjectBlockBytesAllocated, sizeof(ControlBlockObject));
     }
 
-    template <typename F>
-    ControlBlockPtr(const ControlBlockPtr<F>& other) {
-        ptr_ = other.ptr_;
-        shared_counter_ = other.shared_counter_;
+    T* GetPointer() {
+        return reinterpret_cast<T*>(&ptr_);
     }
 
-    ControlBlockPtr& operator=(const ControlBlockPtr& other) {
-        if (this == &other) {
-            return *this;
+private:
+    std::aligned_storage_t<sizeof(T), alignof(T)> ptr_;
+
+    static void Manage(Base* base, typename Base::Operation operation) {
+        auto* block = static_cast<ControlBlockObject*>(base);
+        if (operation == Base::Operation::kDispose) {
+            std::destroy_at(std::launder(reinterpret_cast<T*>(&block->ptr_)));
+            if (!block->ReleaseDisposedWeak()) {
+                detail::AddZombieBytes(sizeof(T));
+                return;
+            }
+        } else {
+            detail::RemoveZombieBytes(sizeof(T));
         }
-        ptr_ = other.ptr_;
-        shared_counter_ = other.shared_counter_;
-        return *this;
+        CountStat(Stat::kObjectBlockBytesFreed, sizeof(ControlBlockObject));
+        delete block;
+    }
+};
+
+// Control block with `size` elements of `T`: in the same allocation, or, from
+// `kSeparateObjectBytes` up, in their own one that is freed as soon as the elements are destroyed.
+template <typename T, typename Counter>
+class ControlBlockArray : public ControlBlock<Counter> {
+    using Base = ControlBlock<Counter>;
+
+public:
+    // Every element is constructed from `args`: none for value-initialization, or a single value
+    // to copy.
+    template <typename... Args>
+    static ControlBlockArray* Create(size_t size, const Args&... args) {
+        return Build(size, [&args...](T* element) { ::new (element) T(args...); });
+    }
+
+    // Default-initialized elements: trivial types are left as they are.
+    static ControlBlockArray* Create(size_t size, detail::ForOverwrite) {
+        return Build(size, [](T* element) { ::new (element) T; });
     }
 
-    template <typename F>
-    ControlBlockPtr& operator=(const ControlBlockPtr<F>& other) {
-        if (this == &other) {
-            return *this;
+    T* GetPointer() {
+        return elements_;
+    }
+
+private:
+    size_t size_;
+    T* elements_;
+
+    explicit ControlBlockArray(size_t size) : Base(&Manage) {
+        size_ = size;
+        elements_ = InlineElements();
+    }
+
+    // Constructs the elements in order; if one throws, the constructed ones are destroyed in
+    // reverse and the memory is freed.
+    template <typename Construct>
+    static ControlBlockArray* Build(size_t size, Construct construct) {
+        if (size > (SIZE_MAX - ElementsOffset()) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        bool separate = size * sizeof(T) >= kSeparateObjectBytes;
+        size_t block_bytes = separate ? ElementsOffset() : ElementsOffset() + size * sizeof(T);
+        auto* block = ::new (Allocate(block_bytes)) ControlBlockArray(size);
+        if (separate) {
+            try {
+                block->elements_ = static_cast<T*>(Allocate(size * sizeof(T)));
+            } catch (...) {
+                block->~ControlBlockArray();
+                Deallocate(block, block_bytes);
+                throw;
+            }
         }
-        ptr_ = other.ptr_;
-        shared_counter_ = other.shared_counter_;
-        return *this;
+        T* elements = block->elements_;
+        size_t constructed = 0;
+        try {
+            for (; constructed < size; ++constructed) {
+                construct(elements + constructed);
+            }
+        } catch (...) {
+            std::destroy(std::reverse_iterator(elements + constructed),
+                         std::reverse_iterator(elements));
+            if (separate) {
+                Deallocate(elements, size * sizeof(T));
+            }
+            block->~ControlBlockArray();
+            Deallocate(block, block_bytes);
+            throw;
+        }
+        return block;
+    }
+
+    T* InlineElements() {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + ElementsOffset());
+    }
+
+    static constexpr size_t ElementsOffset() {
+        return (sizeof(ControlBlockArray) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    static constexpr bool kOverAligned = alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    static void* Allocate(size_t bytes) {
+        if constexpr (kOverAligned) {
+            return ::operator new(bytes, std::align_val_t(alignof(T)));
+        } else {
+            return SlabAllocator::Allocate(bytes);
+        }
+    }
+
+    static void Deallocate(void* ptr, size_t bytes) {
+        if constexpr (kOverAligned) {
+            ::operator delete(ptr, bytes, std::align_val_t(alignof(T)));
+        } else {
+            SlabAllocator::Deallocate(ptr, bytes);
+        }
+    }
+
+    static void Manage(Base* base, typename Base::Operation operation) {
+        auto* block = static_cast<ControlBlockArray*>(base);
+        size_t bytes = block->size_ * sizeof(T);
+        bool separate = block->elements_ != block->InlineElements();
+        if (operation == Base::Operation::kDispose) {
+            T* elements = std::launder(block->elements_);
+            std::destroy(std::reverse_iterator(elements + block->size_),
+                         std::reverse_iterator(elements));
+            if (separate) {
+                Deallocate(elements, bytes);
+            }
+            if (!block->ReleaseDisposedWeak()) {
+                if (!separate) {
+                    detail::AddZombieBytes(bytes);
+                }
+                return;
+            }
+        } else if (!separate) {
+            detail::RemoveZombieBytes(bytes);
+        }
+        block->~ControlBlockArray();
+        Deallocate(block, separate ? ElementsOffset() : ElementsOffset() + bytes);
+    }
+};
+
+// `ControlBlockPtr` with a user deleter; the block itself is allocated with `Alloc`.
+// Empty deleters and allocators take no space.
+template <typename T, typename Deleter, typename Alloc, typename Counter>
+class ControlBlockPtrAllocator : public ControlBlock<Counter> {
+    using Base = ControlBlock<Counter>;
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockPtrAllocator>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+
+public:
+    // Takes ownership of `ptr` even if the allocation fails.
+    static ControlBlockPtrAllocator* Create(T* ptr, Deleter deleter, const Alloc& alloc) {
+        BlockAlloc block_alloc(alloc);
+        ControlBlockPtrAllocator* block;
+        try {
+            block = BlockTraits::allocate(block_alloc, 1);
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+        return ::new (block) ControlBlockPtrAllocator(ptr, std::move(deleter), block_alloc);
     }
 
 private:
-    T* ptr_;
+    CompressedPair<T*, CompressedPair<Deleter, BlockAlloc>> data_;
 
-    void Destroy() override {
-        delete ptr_;
+    ControlBlockPtrAllocator(T* ptr, Deleter&& deleter, const BlockAlloc& alloc)
+        : Base(&Manage),
+          data_(ptr, CompressedPair<Deleter, BlockAlloc>(std::move(deleter), alloc)) {
+    }
+
+    static void Manage(Base* base, typename Base::Operation operation) {
+        auto* block = static_cast<ControlBlockPtrAllocator*>(base);
+        if (operation == Base::Operation::kDispose) {
+            block->data_.GetSecond().GetFirst()(block->data_.GetFirst());
+            if (!block->ReleaseDisposedWeak()) {
+                return;
+            }
+        }
+        BlockAlloc alloc(std::move(block->data_.GetSecond().GetSecond()));
+        block->~ControlBlockPtrAllocator();
+        BlockTraits::deallocate(alloc, block, 1);
     }
 };
 
-template <typename T>
-class ControlBlockObject : public ControlBlock {
+// `ControlBlockObject` allocated, constructed and destroyed through `Alloc`.
+template <typename T, typename Alloc, typename Counter>
+class ControlBlockObjectAllocator : public ControlBlock<Counter> {
+    using Base = ControlBlock<Counter>;
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockObjectAllocator>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+    using ObjectAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<std::remove_cv_t<T>>;
+    using Storage = std::aligned_storage_t<sizeof(T), alignof(T)>;
+
 public:
     template <typename... Args>
-    ControlBlockObject(Args&&... args) {
-        ::new (&ptr_) T(std::forward<Args>(args)...);
-        shared_counter_ = 1;
-        weak_counter_ = 0;
+    static ControlBlockObjectAllocator* Create(const Alloc& alloc, Args&&... args) {
+        BlockAlloc block_alloc(alloc);
+        ControlBlockObjectAllocator* block = BlockTraits::allocate(block_alloc, 1);
+        try {
+            return ::new (block)
+                ControlBlockObjectAllocator(block_alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            BlockTraits::deallocate(block_alloc, block, 1);
+            throw;
+        }
     }
 
     T* GetPointer() {
-        return reinterpret_cast<T*>(&ptr_);
+        return reinterpret_cast<T*>(&data_.GetSecond());
     }
 
 private:
-    std::aligned_storage_t<sizeof(T), alignof(T)> ptr_;
+    CompressedPair<BlockAlloc, Storage> data_;
 
-    void Destroy() override {
-        std::destroy_at(std::launder(reinterpret_cast<T*>(&ptr_)));
+    template <typename... Args>
+    ControlBlockObjectAllocator(const BlockAlloc& alloc, Args&&... args)
+        : Base(&Manage), data_(alloc, Storage()) {
+        ObjectAlloc object_alloc(alloc);
+        std::allocator_traits<ObjectAlloc>::construct(
+            object_alloc, const_cast<std::remove_cv_t<T>*>(GetPointer()),
+            std::forward<Args>(args)...);
+        CountStat(Stat::kObjectBlockBytesAllocated, sizeof(ControlBlockObjectAllocator));
     }
-};
\ No newline at end of file
+
+    static void Manage(Base* base, typename Base::Operation operation) {
+        auto* block = static_cast<ControlBlockObjectAllocator*>(base);
+        if (operation == Base::Operation::kDispose) {
+            ObjectAlloc object_alloc(block->data_.GetFirst());
+            std::allocator_traits<ObjectAlloc>::destroy(
+                object_alloc, const_cast<std::remove_cv_t<T>*>(std::launder(block->GetPointer())));
+            if (!block->ReleaseDisposedWeak()) {
+                detail::AddZombieBytes(sizeof(T));
+                return;
+            }
+        } else {
+            detail::RemoveZombieBytes(sizeof(T));
+        }
+        CountStat(Stat::kObjectBlockBytesFreed, sizeof(ControlBlockObjectAllocator));
+        BlockAlloc alloc(std::move(block->data_.GetFirst()));
+        block->~ControlBlockObjectAllocator();
+        BlockTraits::deallocate(alloc, block, 1);
+    }
+};
@@ -3,14 +3,17 @@
 #include "sw_fwd.h"  // Forward declaration
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Counter>
 class WeakPtr {
-    template <typename Y>
+    template <typename Y, typename C>
     friend class SharedPtr;
 
-    template <typename Y>
+    template <typename Y, typename C>
     friend class WeakPtr;
 
+    template <typename Y, typename C>
+    friend class EnableSharedFromThis;
+
 public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
@@ -35,7 +38,7 @@ public:
 
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
-    WeakPtr(const SharedPtr<T>& other) {
+    WeakPtr(const SharedPtr<T, Counter>& other) {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
         IncreaseCounter();
@@ -107,17 +110,21 @@ public:
     bool Expired() const {
         return UseCount() == 0;
     }
-    SharedPtr<T> Lock() const {
-        if (Expired()) {
-            return SharedPtr<T>();
+    SharedPtr<T, Counter> Lock() const {
+        SharedPtr<T, Counter> locked;
+        if (control_block_ != nullptr && control_block_->TryIncreaseSharedCounter()) {
+            locked.control_block_ = control_block_;
+            locked.ptr_ = ptr_;
+            CountStat(Stat::kLockSucceeded);
         } else {
-            return SharedPtr<T>(*this);
+            CountStat(Stat::kLockFailed);
         }
+        return locked;
     }
 
 private:
-    ControlBlock* control_block_;
-    T* ptr_;
+    ControlBlock<Counter>* control_block_;
+    std::remove_extent_t<T>* ptr_;
 
     void IncreaseCounter() {
         if (control_block_ == nullptr) {
@@ -131,9 +138,6 @@ private:
             return;
         }
         control_block_->DecreaseWeakCounter();
-        if (UseCount() == 0 && UseWeakCount() == 0) {
-            delete control_block_;
-        }
         control_block_ = nullptr;
         ptr_ = nullptr;
     }